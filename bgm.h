@@ -0,0 +1,2610 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bgm_cache.h"
+#include "bgm_context.h"
+#include "bgm_convert.h"
+#include "bgm_io.h"
+#include "bgm_mix.h"
+#include "bgm_probe.h"
+#include "bgm_queue.h"
+#include "bgm_telemetry.h"
+#include "bgm_time.h"
+#include "miniaudio.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/intreadwrite.h"
+#include "libswresample/swresample.h"
+}
+
+typedef enum : int {
+  BGM_OK = 0,
+  BGM_FORMAT_CONTEXT,        /*Allocate an AVFormatContext*/
+  BGM_OPEN_INPUT,            /*Open an input stream and read the header*/
+  BGM_FIND_STREAM_INFO,      /*Read packets of a media file to get stream
+                                information*/
+  BGM_FIND_AUDIO_STREAM,     /*audio stream not find*/
+  BGM_CODEC,                 /*Codec not found*/
+  BGM_CODEC_CONTEXT,         /*Allocate an AVCodecContext*/
+  BGM_PARAMETERS_TO_CONTEXT, /*Fill the codec context based on the values
+                                    from the supplied codec parameters*/
+  BGM_OPEN2,        /*Initialize the AVCodecContext to use the given AVCodec*/
+  BGM_PACKET_ALLOC, /*Allocate an AVPacket*/
+  BGM_FRAME_ALLOC,  /*Allocate an AVFrame*/
+  BGM_SWR_ALLOC,    /*Allocate SwrContext*/
+  BGM_PCM_ALLOC,    /*Allocate the PCM buffer*/
+  BGM_DEVICE_INIT,  /*device init*/
+  BGM_PLAY,         /*play*/
+  BGM_PAUSE,        /*pause*/
+  BGM_RB_INIT,      /*Allocate a ma_pcm_rb*/
+  BGM_THREAD,       /*Start the decode thread*/
+  BGM_SWR_INIT,     /*Initialize SwrContext*/
+  BGM_OUTPUT_FORMAT, /*Unsupported output format*/
+  BGM_SEEK,          /*Seek to the decode range*/
+  BGM_LOOP,          /*Invalid or unknown loop region*/
+  BGM_CROSSFADE,     /*A crossfade is already in progress*/
+  BGM_MIXER_FULL,    /*No free mixer slot*/
+  BGM_CONTEXT_INIT,  /*Initialize the shared ma_context*/
+  BGM_RENDER,        /*Open or write the render output*/
+} bgm_result;
+
+static std::string_view bgm_result_strings[] = {
+    "ok",
+    "Allocate an AVFormatContext",
+    "Open an input stream and read the header",
+    "Read packets of a media file to get stream information",
+    "audio stream not find",
+    "Codec not found",
+    "Allocate an AVCodecContext",
+    "Fill the codec context based on the values from the supplied codec "
+    "parameters",
+    "Initialize the AVCodecContext to use the given AVCodec",
+    "Allocate an AVPacket",
+    "Allocate an AVFrame",
+    "Allocate SwrContext",
+    "Allocate the PCM buffer",
+    "device init",
+    "play",
+    "pause",
+    "Allocate a ma_pcm_rb",
+    "Start the decode thread",
+    "Initialize SwrContext",
+    "Unsupported output format",
+    "Seek to the decode range",
+    "Invalid or unknown loop region",
+    "A crossfade is already in progress",
+    "No free mixer slot",
+    "Initialize the shared ma_context",
+    "Open or write the render output",
+};
+
+std::string_view inline bgm_result2str(bgm_result ret) {
+  return bgm_result_strings[ret];
+};
+
+typedef struct {
+  /*
+  边解码边播放：解码线程只提前解码 bufferSizeInMilliseconds 的数据到环形缓冲区，
+  内存占用与音频长度无关。关闭后在 init 中一次性解码整个文件
+  */
+  ma_bool32 streaming;
+  ma_uint32 bufferSizeInMilliseconds; /*streaming 模式下环形缓冲区的长度*/
+  ma_bool32 timing; /*记录 init 各阶段耗时，结果见 Bgm::get_timing()*/
+  /*
+  输出给设备的样本格式，支持 ma_format_s16 和 ma_format_f32。
+  大部分解码器输出 fltp，设备后端也大多用 f32 混音，
+  选择 ma_format_f32 时只做一次交错，miniaudio 内部不再转换
+  */
+  ma_format format;
+  /*
+  解码格式是 fltp/s16p/s32p 时使用 bgm_convert.h 中的转换内核代替 swresample，
+  bgm_simd_best 按 CPU 选择指令集，bgm_simd_scalar 只用标量版本
+  */
+  bgm_simd simd;
+  ma_bool32 convertKernels; /*关闭后所有转换都交给 swresample，用于对比*/
+  /*
+  非 streaming 模式下把音频按时间切成 decodeThreads 段，每段在自己的线程里
+  用独立的 AVFormatContext/AVCodecContext 解码后按样本拼接。
+  输入不能 seek、时长未知或者时间戳对不上时退回单线程解码，1 表示单线程
+  */
+  ma_uint32 decodeThreads;
+  /*
+  解码结果的磁盘缓存目录，nullptr 表示不使用缓存。第一次解码完整个文件后
+  写入缓存，之后的 init 命中时直接映射缓存文件播放，不再打开 ffmpeg
+  */
+  const char* cacheDirectory;
+  ma_uint64 cacheSizeInBytes; /*缓存目录的总大小上限，超出时删除最久没用的*/
+  /*
+  本地文件映射到内存后通过自定义的 AVIOContext 读取（bgm_io.h），
+  不能映射的 url 依然交给 ffmpeg 打开
+  */
+  ma_bool32 mmapInput;
+  /*
+  大于 0 时由后台 IO 线程在解复用的读取位置前方预读这么多字节（bgm_io.h），
+  用于 NFS、机械硬盘或者网络地址，优先于 mmapInput。0 表示不预读
+  */
+  ma_uint32 readaheadSizeInBytes;
+  /*
+  av_read_frame 在单独的解复用线程中执行，通过 packetQueueSize 个包的无锁队列
+  交给解码线程，IO 等待和解码互相重叠
+  */
+  ma_bool32 demuxThread;
+  ma_uint32 packetQueueSize;
+  /*
+  输出的声道数和采样率，0 表示和音频相同。和音频不同时由 swresample
+  重采样、重新混音。播放列表中后面的音轨用它对齐到第一首打开的设备
+  */
+  ma_uint32 channels;
+  ma_uint32 sampleRate;
+  /*
+  avformat_find_stream_info 结果的缓存目录（bgm_probe.h），nullptr 时使用
+  cacheDirectory，都为 nullptr 时每次都探测
+  */
+  const char* probeDirectory;
+  /*
+  没有命中探测缓存时 avformat_open_input/avformat_find_stream_info 最多读取的
+  字节数和分析的时长（微秒），0 表示使用 ffmpeg 的默认值
+  */
+  ma_int64 probeSize;
+  ma_int64 analyzeDuration;
+  /*
+  循环播放：先播放一次 [0, loopStart) 的前奏，之后无限重复 [loopStart, loopEnd)。
+  单位是输出的样本帧，loopEnd 为 0 表示到文件结尾。两者都为 0 时读取
+  LOOPSTART/LOOPLENGTH（或 LOOPEND）标签，没有标签时循环整个音轨。
+  streaming 模式下循环段解码一次后常驻内存，之后回绕不再解码。
+  循环播放的音轨不会结束，播放列表不会切换到下一首
+  */
+  ma_bool32 looping;
+  ma_uint64 loopStart;
+  ma_uint64 loopEnd;
+  /*
+  设备使用进程内共享的 ma_context（bgm_context.h），只有第一个设备需要探测后端、
+  加载动态库。关闭后每个设备创建自己的 context
+  */
+  ma_bool32 sharedContext;
+  /*
+  不打开播放设备，由 Bgm::render 尽可能快地把播放列表渲染到文件
+  */
+  ma_bool32 noDevice;
+  /*
+  记录每次播放回调的耗时、间隔抖动和读到的帧数（bgm_telemetry.h），
+  结果见 Bgm::get_callback_stats()
+  */
+  ma_bool32 callbackTelemetry;
+  /*
+  设备缓冲区：每个周期的帧数（优先）或者毫秒数，以及周期数，0 表示由
+  performanceProfile 决定（low_latency 10ms，conservative 100ms，3 个周期）。
+  周期越短延迟越低，播放线程唤醒越频繁；后端不一定按要求分配，
+  实际的大小见 Bgm::get_device_buffer()
+  */
+  ma_uint32 periodSizeInFrames;
+  ma_uint32 periodSizeInMilliseconds;
+  ma_uint32 periods;
+  ma_performance_profile performanceProfile;
+  /*
+  miniaudio 不在回调前把输出缓冲区清零，data_callback 自己补齐读不够的部分
+  */
+  ma_bool32 noPreSilencedOutputBuffer;
+  /*
+  f32 输出不截断到 [-1, 1]，s16 没有影响
+  */
+  ma_bool32 noClip;
+} bgm_config;
+
+bgm_config inline bgm_config_init() {
+  bgm_config config;
+  config.streaming = MA_TRUE;
+  config.bufferSizeInMilliseconds = 300;
+  config.timing = MA_FALSE;
+  config.format = ma_format_s16;
+  config.simd = bgm_simd_best;
+  config.convertKernels = MA_TRUE;
+  config.decodeThreads = 1;
+  config.cacheDirectory = nullptr;
+  config.cacheSizeInBytes = 1024ull * 1024 * 1024;
+  config.mmapInput = MA_TRUE;
+  config.readaheadSizeInBytes = 0;
+  config.demuxThread = MA_TRUE;
+  config.packetQueueSize = 64;
+  config.channels = 0;
+  config.sampleRate = 0;
+  config.probeDirectory = nullptr;
+  config.probeSize = 0;
+  config.analyzeDuration = 0;
+  config.looping = MA_FALSE;
+  config.loopStart = 0;
+  config.loopEnd = 0;
+  config.sharedContext = MA_TRUE;
+  config.noDevice = MA_FALSE;
+  config.callbackTelemetry = MA_FALSE;
+  config.periodSizeInFrames = 0;
+  config.periodSizeInMilliseconds = 0;
+  config.periods = 0;
+  config.performanceProfile = ma_performance_profile_low_latency;
+  config.noPreSilencedOutputBuffer = MA_FALSE;
+  config.noClip = MA_FALSE;
+  return config;
+}
+
+/**
+ * 设备样本格式对应的 ffmpeg 交错格式
+ *
+ * return
+ * AV_SAMPLE_FMT_NONE 不支持的格式
+ */
+AVSampleFormat inline bgm_av_sample_format(ma_format format) {
+  switch (format) {
+    case ma_format_s16:
+      return AV_SAMPLE_FMT_S16;
+    case ma_format_f32:
+      return AV_SAMPLE_FMT_FLT;
+    default:
+      return AV_SAMPLE_FMT_NONE;
+  }
+}
+
+/**
+ * 读取容器或流中的 LOOPSTART/LOOPLENGTH（或 LOOPEND）标签，
+ * RPG Maker 等使用的循环点，单位是音频的样本帧
+ *
+ * params
+ * end 循环段结尾之后的位置，0 表示到文件结尾
+ *
+ * return
+ * false 没有循环标签
+ */
+bool inline bgm_loop_tags(const AVFormatContext* fmt, int64_t* start,
+                          int64_t* end) {
+  auto find = [fmt](const char* key) -> const char* {
+    AVDictionaryEntry* e = av_dict_get(fmt->metadata, key, NULL, 0);
+    for (unsigned i = 0; e == nullptr && i < fmt->nb_streams; i++)
+      e = av_dict_get(fmt->streams[i]->metadata, key, NULL, 0);
+    return e ? e->value : nullptr;
+  };
+
+  const char* loopStart = find("LOOPSTART");
+  if (loopStart == nullptr) return false;
+  const char* loopLength = find("LOOPLENGTH");
+  const char* loopEnd = find("LOOPEND");
+
+  *start = strtoll(loopStart, NULL, 10);
+  *end = loopLength ? *start + strtoll(loopLength, NULL, 10)
+         : loopEnd  ? strtoll(loopEnd, NULL, 10)
+                    : 0;
+  return *start >= 0 && *end >= 0;
+}
+
+/*
+init 到第一次播放出声音的各阶段时间戳（bgm_now_ns），0 表示还没有到达该阶段。
+只有 bgm_config.timing 打开时才会记录
+*/
+typedef struct {
+  int64_t init;           /*init 开始*/
+  int64_t openInput;      /*avformat_open_input 完成*/
+  int64_t findStreamInfo; /*avformat_find_stream_info 或读取探测缓存完成*/
+  int64_t codecOpen;      /*avcodec_open2 完成，_open_src 结束*/
+  int64_t decoder; /*BgmDecoder::init 完成（streaming 模式下是解码线程启动）*/
+  int64_t device;         /*_ma_device 完成，init 结束*/
+  int64_t play;           /*play 开始*/
+  int64_t firstAudio;     /*data_callback 第一次输出非静音帧*/
+} bgm_timing;
+
+typedef struct {
+  ma_uint64 frames;      /*解码出的 AVFrame 数量*/
+  ma_uint64 allocations; /*解码循环中分配播放缓冲区的次数，streaming 时为 0*/
+  ma_bool32 passthrough; /*解码输出已经是设备格式，跳过 swresample*/
+  ma_bool32 cacheHit;    /*从磁盘缓存播放，没有解码*/
+  ma_bool32 probeHit;    /*命中探测缓存，跳过了 avformat_find_stream_info*/
+  std::string_view converter; /*passthrough、swresample、cache 或者内核的指令集*/
+} bgm_decoder_stats;
+
+/*
+Bgm::render 的结果
+*/
+typedef struct {
+  ma_uint64 frames; /*写入的帧数*/
+  double seconds;   /*写入的音频时长*/
+  double elapsed;   /*实际耗时，单位秒*/
+  double realtime;  /*实时倍数：每秒钟渲染的音频秒数*/
+} bgm_render_stats;
+
+/*
+设备初始化后后端实际使用的缓冲区
+*/
+typedef struct {
+  ma_uint32 periodSizeInFrames; /*每个周期的帧数，播放回调一般每个周期调用一次*/
+  ma_uint32 periods;            /*周期数*/
+  ma_uint32 sampleRate;         /*后端的采样率，和输出的采样率不同时由 miniaudio 重采样*/
+  double latency; /*periodSizeInFrames * periods 对应的时长，单位毫秒*/
+} bgm_device_buffer;
+
+/*
+解复用 → 解码 → 播放各阶段的填充程度和等待时间
+*/
+typedef struct {
+  bgm_queue_stats queue;    /*包队列，没有打开 demuxThread 时都是 0*/
+  ma_uint32 outputFrames;   /*环形缓冲区中当前可以播放的帧数*/
+  ma_uint32 outputCapacity; /*环形缓冲区的帧数，非 streaming 模式下为 0*/
+  int64_t outputStall; /*解码线程等待环形缓冲区空位的总时间，单位纳秒*/
+  /*
+  播放回调中解码没有跟上、用静音补齐的次数和帧数，播放结束后的静音不算。
+  只有 Bgm::get_pipeline_stats 会填写
+  */
+  ma_uint64 underruns;
+  ma_uint64 missingFrames;
+} bgm_pipeline_stats;
+
+inline void data_callback(ma_device* pDevice, void* pOutput,
+                          const void* pInput, ma_uint32 frameCount);
+
+class AbstractBgm {
+ public:
+  /**
+   * 初始化资源
+   *
+   * params
+   * url 有音频流的资源
+   *
+   * return
+   * 0 ok
+   */
+  virtual bgm_result init(std::string_view url) = 0;
+
+ public:
+  /**
+   * 销毁资源
+   *
+   * return
+   * 0 ok
+   */
+  virtual void destroy() = 0;
+
+  /**
+   * 播放
+   *
+   * return
+   * 0 ok
+   */
+  virtual bgm_result play() = 0;
+
+  /**
+   * 暂停
+   *
+   * return
+   * 0 ok
+   */
+  virtual bgm_result pause() = 0;
+
+  /**
+   * 跳转到当前音轨的指定位置，精确到样本
+   *
+   * params
+   * seconds 距离音轨开头的秒数
+   *
+   * return
+   * 0 ok
+   */
+  virtual bgm_result seek(double seconds) = 0;
+};
+
+/*
+一个音轨的解码：打开 url、解复用、解码并转换到输出格式，由 read_pcm_frames
+取出交错样本。不包含播放设备，Bgm 用它播放，播放列表中每首音轨一个
+*/
+class BgmDecoder {
+ private:
+  AVFormatContext* pFormatContext{nullptr};
+  bgm_mmap_io mmapIo{};
+  std::unique_ptr<BgmReadaheadIo> readahead;
+  bgm_io_stats ioStats{};  // readahead 释放前的统计
+  AVCodecParameters* pCodecParameters{nullptr};
+  const AVCodec* pCodec{nullptr};
+  AVCodecContext* pCodecContext{nullptr};
+  int audio_stream_index = -1;
+
+  // 输出的声道数和采样率，_decoder_free 之后依然有效
+  ma_uint32 channels = 0;
+  ma_uint32 sampleRate = 0;
+  int64_t channelLayout = 0;
+  // 解码器输出的声道数和采样率，和输出不同时需要 swresample
+  ma_uint32 srcChannels = 0;
+  ma_uint32 srcSampleRate = 0;
+  int64_t srcChannelLayout = 0;
+
+  // 解码器输出的格式和设备格式一致时不需要 SwrContext
+  bool passthrough = false;
+  // 有对应的转换内核时也不需要 SwrContext
+  bgm_convert_proc convert{nullptr};
+  bgm_simd convertSimd = bgm_simd_scalar;
+
+  AVPacket* pPacket{nullptr};
+  AVFrame* pFrame{nullptr};
+  SwrContext* swr{nullptr};
+
+  // 非 streaming 模式下整个音频解码后的交错样本
+  uint8_t* pcm{nullptr};
+  ma_uint64 pcmFrames = 0;
+  ma_uint64 pcmCapacity = 0;
+  std::atomic<ma_uint64> pcmCursor{0};
+
+  ma_pcm_rb rb;
+  bool rbInitialized = false;
+
+  bool probeHit = false;  // 命中探测缓存
+  std::thread decodeThread;
+  std::atomic<bool> decodeStop{false};
+  std::atomic<bool> decodeDone{false};  // 已经解码到文件结尾或者出错
+
+  // config.demuxThread 打开时解复用线程通过 packetQueue 把包交给解码线程
+  BgmPacketQueue packetQueue;
+  std::thread demuxThread;
+  bool demuxing = false;
+  std::atomic<int64_t> outputStall{0};
+  // 播放线程读走数据后环形缓冲区低于一半、欠载或者停止解码时加一，
+  // 唤醒等待空位的解码线程
+  std::atomic<uint32_t> refill{0};
+  // 解码线程写入样本或者结束时加一并唤醒等待者，由 set_progress_signal 设置
+  std::atomic<uint32_t>* progress = nullptr;
+
+  // 磁盘缓存，cacheKey 为空表示不缓存
+  std::string cacheKey;
+  bgm_cache_entry cache{};
+  bool cacheHit = false;
+  bgm_cache_writer cacheWriter{};
+
+  // _decode_range 和 seek 之后只保留样本位置在 [rangeStart, rangeEnd) 之间的
+  // 样本。样本位置按解码器的采样率、从流的 start_time 开始计算
+  bool ranged = false;
+  int64_t rangeStart = 0;
+  int64_t rangeEnd = INT64_MAX;
+  int64_t rangeFirst = -1;    // 第一个保留的样本位置，-1 表示还没有
+  int64_t framePosition = 0;  // 最近解码的一帧之后的样本位置
+  // framePosition 可信，帧没有时间戳时接着它计算（按字节 seek 之后）
+  bool framePositionValid = false;
+  // framePosition 不可信时也从它开始数样本（seek 之后），否则停止解码
+  bool framePositionFallback = false;
+
+  // 包索引（bgm_probe.h），seek 时直接跳到目标之前最近的包
+  std::vector<bgm_index_entry> packetIndex;
+  bool indexing = false;      // 正在从头顺序解复用并记录包索引
+  // packetIndex 覆盖整个文件：读取了保存的索引，或者记录到了文件结尾。
+  // 否则只覆盖从开头到最后一项，之后的位置要按时间戳 seek
+  bool indexComplete = false;
+  // 第一次 seek 打断顺序记录时，后台线程单独打开本地文件、只解复用到结尾来建立
+  // 完整的索引，完成后在 indexMutex 保护下替换 packetIndex
+  std::string indexUrl;  // 不是本地文件时为空，不在后台建立索引
+  std::thread indexThread;
+  std::atomic<bool> indexStop{false};
+  std::mutex indexMutex;
+  // 解复用读到了文件结尾，之后不再写入 packetIndex，索引是完整的
+  std::atomic<bool> demuxEnd{false};
+  int64_t indexInterval = 0;  // 相邻索引项的最小间隔，time_base 为单位
+  std::string indexDirectory;
+  std::string indexKey;
+
+  // 编码器延迟（priming）和结尾填充。解码器不自己丢弃这些样本，
+  // 而是通过 AV_FRAME_DATA_SKIP_SAMPLES 告诉我们，由 _output_frame 统一裁剪
+  ma_uint64 skipFrames = 0;    // 还需要丢弃的开头样本数
+  bool firstFrame = true;      // 还没有解码出第一帧
+  bool startOfStream = true;   // 从文件开头解码，没有 seek 过
+  // 开头裁掉的编码器延迟，样本位置 primingFrames 是输出的第 0 帧
+  int64_t primingFrames = 0;
+  bool primingKnown = false;
+
+  // 循环播放，单位是输出帧。streaming 模式下 [loopStart, loopEnd) 解码后
+  // 常驻在 loopPcm 中，之前的前奏经过环形缓冲区播放
+  bool looping = false;
+  ma_uint64 loopStart = 0;
+  ma_uint64 loopEnd = 0;  // 0 表示到文件结尾
+  // 循环到文件结尾时时长只是估算，解码线程按需扩容。播放线程可能还在读旧的
+  // 缓冲区，旧缓冲区保留在 loopRetired 中，uninit 时才释放
+  std::atomic<uint8_t*> loopPcm{nullptr};
+  std::vector<uint8_t*> loopRetired;
+  ma_uint64 loopCapacity = 0;            // loopPcm 的帧数
+  std::atomic<ma_uint64> loopFrames{0};  // loopPcm 中已经解码的帧数
+  std::atomic<bool> introDone{false};    // 前奏已经全部写入环形缓冲区
+  ma_uint64 outputPosition = 0;  // 解码线程已经输出到的位置
+  bool inLoop = false;           // 播放线程已经读完前奏
+  ma_uint64 loopCursor = 0;      // 播放线程在 loopPcm 中的读取位置
+
+  bgm_timing timing{};
+  std::atomic<ma_uint64> decodedFrames{0};
+  std::atomic<ma_uint64> decodeAllocations{0};
+
+ private:
+  void inline _mark(int64_t& stage) {
+    if (config.timing) stage = bgm_now_ns();
+  }
+
+  /**
+   * 打开音频文件
+   *
+   * params
+   * url 有音频流的资源
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _open_src(std::string_view url) {
+    if ((pFormatContext = avformat_alloc_context()) == nullptr)
+      return BGM_FORMAT_CONTEXT;
+    indexUrl = bgm_file_key(url).empty() ? "" : std::string(url);
+
+    if (config.readaheadSizeInBytes > 0) {
+      readahead = std::make_unique<BgmReadaheadIo>();
+      if (readahead->open(url.data(), config.readaheadSizeInBytes)) {
+        pFormatContext->pb = readahead->pb;
+      } else {
+        readahead.reset();
+      }
+    }
+    if (pFormatContext->pb == nullptr && config.mmapInput &&
+        bgm_mmap_io_open(&mmapIo, url.data()))
+      pFormatContext->pb = mmapIo.pb;
+
+    if (config.probeSize > 0) pFormatContext->probesize = config.probeSize;
+    if (config.analyzeDuration > 0)
+      pFormatContext->max_analyze_duration = config.analyzeDuration;
+
+    if (avformat_open_input(&pFormatContext, url.data(), NULL, NULL) != 0)
+      return BGM_OPEN_INPUT;
+    _mark(timing.openInput);
+
+    const char* probeDir =
+        config.probeDirectory ? config.probeDirectory : config.cacheDirectory;
+    std::string probeKey = probeDir ? bgm_file_key(url) : "";
+    // 没有文件头的封装（AVFMTCTX_NOHEADER，例如 FLV）在探测中才创建流
+    unsigned openStreams = pFormatContext->nb_streams;
+    audio_stream_index =
+        probeKey.empty() ? -1 : bgm_probe_load(probeDir, probeKey,
+                                               pFormatContext);
+    probeHit = audio_stream_index >= 0;
+
+    if (!probeHit) {
+      if (avformat_find_stream_info(pFormatContext, NULL) < 0)
+        return BGM_FIND_STREAM_INFO;
+
+      audio_stream_index = av_find_best_stream(
+          pFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+      if (audio_stream_index < 0) return BGM_FIND_AUDIO_STREAM;
+
+      // 打开之后还没有这个流时缓存永远用不上，不写入
+      if (!probeKey.empty() && (unsigned)audio_stream_index < openStreams)
+        bgm_probe_store(probeDir, probeKey, pFormatContext,
+                        audio_stream_index, openStreams);
+    }
+    _mark(timing.findStreamInfo);
+
+    // 没有保存的包索引时在第一次顺序解码中记录，间隔 0.1 秒。解复用到文件结尾
+    // 才算完整并保存；到结尾之前 seek 时改由 _index_scan 在后台建立
+    indexDirectory = probeDir ? probeDir : "";
+    indexKey = probeKey;
+    packetIndex.clear();
+    indexComplete = !indexKey.empty() &&
+                    bgm_index_load(indexDirectory, indexKey,
+                                   audio_stream_index, packetIndex);
+    indexing = !indexComplete;
+    indexInterval = std::max<int64_t>(
+        1, av_rescale_q(1, av_make_q(1, 10),
+                        pFormatContext->streams[audio_stream_index]->time_base));
+
+    pCodecParameters = pFormatContext->streams[audio_stream_index]->codecpar;
+    pCodec = avcodec_find_decoder(pCodecParameters->codec_id);  // 获取解码器
+    if (!pCodec) return BGM_CODEC;
+
+    pCodecContext = avcodec_alloc_context3(pCodec);
+    if (pCodecContext == nullptr) return BGM_CODEC_CONTEXT;
+
+    if (avcodec_parameters_to_context(pCodecContext, pCodecParameters) < 0)
+      return BGM_PARAMETERS_TO_CONTEXT;
+
+    // 开头和结尾要丢弃的样本由 _output_frame 裁剪，和 seek、分段解码一致
+    pCodecContext->flags2 |= AV_CODEC_FLAG2_SKIP_MANUAL;
+
+    if (avcodec_open2(pCodecContext, pCodec, NULL) < 0) return BGM_OPEN2;
+    srcChannels = pCodecParameters->channels;
+    srcSampleRate = pCodecParameters->sample_rate;
+    // wav 等格式可能没有声道布局，swr_init 需要一个有效的布局
+    srcChannelLayout = pCodecParameters->channel_layout
+                           ? pCodecParameters->channel_layout
+                           : av_get_default_channel_layout(srcChannels);
+
+    channels = config.channels ? config.channels : srcChannels;
+    sampleRate = config.sampleRate ? config.sampleRate : srcSampleRate;
+    channelLayout = channels == srcChannels
+                        ? srcChannelLayout
+                        : av_get_default_channel_layout(channels);
+    bool remix = channels != srcChannels || sampleRate != srcSampleRate;
+
+    passthrough = !remix && pCodecContext->sample_fmt ==
+                                bgm_av_sample_format(config.format);
+    convertSimd =
+        config.simd == bgm_simd_best ? bgm_simd_detect() : config.simd;
+    if (!passthrough && !remix && config.convertKernels)
+      convert = bgm_convert_find(pCodecContext->sample_fmt,
+                                 bgm_av_sample_format(config.format),
+                                 convertSimd);
+    _mark(timing.codecOpen);
+
+    return BGM_OK;
+  };
+
+  /**
+   * 分配解码需要的 AVPacket、AVFrame 和 SwrContext
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _decoder_init() {
+    if ((pPacket = av_packet_alloc()) == nullptr) return BGM_PACKET_ALLOC;
+    if ((pFrame = av_frame_alloc()) == nullptr) return BGM_FRAME_ALLOC;
+    if (passthrough || convert != nullptr) return BGM_OK;
+
+    swr = swr_alloc_set_opts(
+        NULL,  // 我们正在分配一个新的上下文
+        channelLayout,                             // out_ch_layout
+        bgm_av_sample_format(config.format),       // out_sample_fmt
+        sampleRate,                                // out_sample_rate
+        srcChannelLayout,                          // in_ch_layout
+        (AVSampleFormat)pCodecParameters->format,  // in_sample_fmt
+        srcSampleRate,                             // in_sample_rate
+        0,                                         // log_offset
+        NULL);                                     // log_ctx
+    if (swr == nullptr) return BGM_SWR_ALLOC;
+    if (swr_init(swr) < 0) return BGM_SWR_INIT;
+
+    return BGM_OK;
+  }
+
+  /**
+   * 释放解码用到的所有 ffmpeg 资源
+   */
+  void _decoder_free() {
+    avformat_close_input(&pFormatContext);
+    bgm_mmap_io_close(&mmapIo);
+    if (readahead) ioStats = readahead->get_stats();
+    readahead.reset();
+    av_packet_free(&pPacket);
+    av_frame_free(&pFrame);
+    packetQueue.uninit();
+    avcodec_free_context(&pCodecContext);
+    swr_free(&swr);
+  }
+
+  /**
+   * 从播放缓冲区预留一段可写区域，转换器直接写入其中
+   *
+   * streaming 模式下环形缓冲区写满时会等待播放线程消费，
+   * 非 streaming 模式下 PCM 缓冲区不够时按两倍扩容
+   *
+   * params
+   * frames 需要的帧数
+   * ppWrite 可写区域
+   *
+   * return
+   * 可写的帧数，可能少于 frames；0 表示分配失败或者解码线程被要求退出
+   */
+  ma_uint32 _acquire_write(ma_uint32 frames, void** ppWrite) {
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+
+    if (!config.streaming) {
+      if (pcmFrames + frames > pcmCapacity) {
+        ma_uint64 capacity = std::max<ma_uint64>(pcmCapacity * 2, 65536);
+        while (capacity < pcmFrames + frames) capacity *= 2;
+        uint8_t* p = (uint8_t*)av_realloc(pcm, capacity * bpf);
+        if (p == nullptr) {
+          decodeStop = true;
+          return 0;
+        }
+        pcm = p;
+        pcmCapacity = capacity;
+        decodeAllocations++;
+      }
+      *ppWrite = pcm + pcmFrames * bpf;
+      return frames;
+    }
+
+    if (looping) {
+      if (outputPosition >= loopStart) {
+        ma_uint64 offset = outputPosition - loopStart;
+        // 指定了 loopEnd 时循环段已经完整，否则是估算的时长不够
+        if (offset >= loopCapacity && (loopEnd != 0 || !_loop_grow())) {
+          decodeStop = true;
+          return 0;
+        }
+        *ppWrite = loopPcm.load() + offset * bpf;
+        return (ma_uint32)std::min<ma_uint64>(frames, loopCapacity - offset);
+      }
+      // 前奏和循环段的分界处分成两次写入
+      frames = (ma_uint32)std::min<ma_uint64>(frames,
+                                              loopStart - outputPosition);
+    }
+
+    while (!decodeStop.load()) {
+      // 先读 refill 再检查空位，检查之后播放线程的唤醒不会丢失
+      uint32_t signal = refill.load();
+      ma_uint32 available = frames;
+      if (ma_pcm_rb_acquire_write(&rb, &available, ppWrite) != MA_SUCCESS)
+        return 0;
+      if (available > 0) return available;
+
+      // 缓冲区满了，等待播放线程读到只剩一半或者欠载时唤醒
+      int64_t begin = bgm_now_ns();
+      refill.wait(signal);
+      outputStall += bgm_now_ns() - begin;
+    }
+
+    return 0;
+  }
+
+  /**
+   * 循环到文件结尾、解码到的长度超过了按时长估算的缓冲区时扩容一倍，
+   * 由解码线程调用。先发布新的缓冲区再增加 loopFrames，
+   * 播放线程读到的缓冲区一定包含它看到的所有帧
+   *
+   * return
+   * false 分配失败，循环段被截断
+   */
+  bool _loop_grow() {
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+    ma_uint64 capacity = loopCapacity * 2;
+    uint8_t* p = (uint8_t*)av_malloc(capacity * bpf);
+    if (p == nullptr) {
+      av_log(NULL, AV_LOG_ERROR,
+             "bgm: loop region truncated at %llu frames, out of memory\n",
+             (unsigned long long)loopCapacity);
+      return false;
+    }
+
+    uint8_t* old = loopPcm.load();
+    memcpy(p, old, loopCapacity * bpf);
+    loopRetired.push_back(old);
+    loopPcm = p;
+    loopCapacity = capacity;
+    decodeAllocations++;
+    return true;
+  }
+
+  void _signal_progress() {
+    if (progress == nullptr) return;
+    progress->fetch_add(1);
+    progress->notify_all();
+  }
+
+  /**
+   * 提交 _acquire_write 预留区域中实际写入的帧数。
+   * streaming 模式下同时追加到磁盘缓存
+   */
+  void _commit_write(const void* pWrite, ma_uint32 frames) {
+    if (config.streaming) {
+      if (looping && outputPosition >= loopStart) {
+        loopFrames = outputPosition + frames - loopStart;
+      } else {
+        bgm_cache_write(&cacheWriter, pWrite, frames);
+        ma_pcm_rb_commit_write(&rb, frames);
+      }
+      outputPosition += frames;
+      if (looping && outputPosition >= loopStart) introDone = true;
+      _signal_progress();
+    } else {
+      pcmFrames += frames;
+    }
+  }
+
+  /**
+   * 不经过 swresample，用转换内核把解码结果写入播放缓冲区；
+   * 解码结果已经是设备格式的交错样本时直接复制
+   */
+  void _write_frame(const AVFrame* frame, ma_uint32 offset, ma_uint32 count) {
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+    ma_uint32 written = offset;
+
+    while (written < offset + count) {
+      void* pWrite;
+      ma_uint32 frames = _acquire_write(offset + count - written, &pWrite);
+      if (frames == 0) break;
+
+      if (convert != nullptr) {
+        convert(pWrite, frame->extended_data, written, frames, channels);
+      } else {
+        memcpy(pWrite, frame->data[0] + written * bpf, frames * bpf);
+      }
+      _commit_write(pWrite, frames);
+      written += frames;
+    }
+  }
+
+  /**
+   * 把一帧解码结果转换为设备格式的交错样本，直接写入播放缓冲区
+   *
+   * 预留的区域不够时（环形缓冲区回绕），剩余的样本暂存在 SwrContext 中，
+   * 下一次预留后再取出
+   *
+   * params
+   * offset 从帧内第几个样本开始
+   * count 转换的样本数
+   */
+  void _convert_frame(const AVFrame* frame, ma_uint32 offset,
+                      ma_uint32 count) {
+    if (passthrough || convert != nullptr) {
+      _write_frame(frame, offset, count);
+      return;
+    }
+
+    const uint8_t** in = (const uint8_t**)frame->extended_data;
+    int in_samples = count;
+
+    // 只有裁剪编码器延迟、seek 和 _decode_range 之后的首尾两帧需要跳过开头的
+    // 样本。声道布局是 64 位掩码，swresample 最多支持 64 个声道，放在栈上
+    const uint8_t* planes[64];
+    if (offset > 0) {
+      AVSampleFormat fmt = (AVSampleFormat)frame->format;
+      int planar = av_sample_fmt_is_planar(fmt);
+      int stride = av_get_bytes_per_sample(fmt) * (planar ? 1 : srcChannels);
+      ma_uint32 n = planar ? std::min<ma_uint32>(srcChannels, 64) : 1;
+      for (ma_uint32 i = 0; i < n; i++)
+        planes[i] = frame->extended_data[i] + (size_t)offset * stride;
+      in = planes;
+    }
+
+    for (;;) {
+      int out_samples = swr_get_out_samples(swr, in_samples);
+      if (out_samples <= 0) break;
+
+      void* pWrite;
+      ma_uint32 frames = _acquire_write(out_samples, &pWrite);
+      if (frames == 0) break;
+
+      int n = swr_convert(swr, (uint8_t**)&pWrite, frames, in, in_samples);
+      if (n < 0) break;
+      _commit_write(pWrite, n);
+
+      in = NULL;
+      in_samples = 0;
+      if (n == 0) break;
+    }
+  }
+
+  /**
+   * 取出 SwrContext 中剩余的样本，文件结束时调用
+   */
+  void _flush_swr() {
+    if (swr == nullptr) return;
+
+    for (;;) {
+      int out_samples = swr_get_out_samples(swr, 0);
+      if (out_samples <= 0) break;
+
+      void* pWrite;
+      ma_uint32 frames = _acquire_write(out_samples, &pWrite);
+      if (frames == 0) break;
+
+      int n = swr_convert(swr, (uint8_t**)&pWrite, frames, NULL, 0);
+      if (n <= 0) break;
+      _commit_write(pWrite, n);
+    }
+  }
+
+  /**
+   * 按时间戳计算一帧的样本位置，只把帧内 [begin, end) 中落在
+   * [rangeStart, rangeEnd) 的部分写入 PCM 缓冲区。没有时间戳时接着上一帧
+   * 计算；seek 之后第一帧就没有时间戳时从 seek 的位置开始数，
+   * _decode_range 的拼接必须准确，这时停止解码
+   */
+  void _convert_range(const AVFrame* frame, ma_uint32 begin, ma_uint32 end) {
+    AVStream* stream = pFormatContext->streams[audio_stream_index];
+    int64_t ts = frame->pts != AV_NOPTS_VALUE ? frame->pts
+                                              : frame->best_effort_timestamp;
+    int64_t position = framePosition;
+    if (ts != AV_NOPTS_VALUE) {
+      if (stream->start_time != AV_NOPTS_VALUE) ts -= stream->start_time;
+      position =
+          av_rescale_q(ts, stream->time_base, av_make_q(1, srcSampleRate));
+    } else if (!framePositionValid && !framePositionFallback) {
+      decodeStop = true;
+      return;
+    }
+    framePosition = position + frame->nb_samples;
+    framePositionValid = true;
+
+    int64_t first = std::max(position + begin, rangeStart);
+    int64_t last = std::min(position + end, rangeEnd);
+    if (first >= last) return;
+
+    if (rangeFirst < 0) rangeFirst = first;
+    _convert_frame(frame, (ma_uint32)(first - position),
+                   (ma_uint32)(last - first));
+  }
+
+  /**
+   * 裁掉一帧中编码器延迟和结尾填充的部分，剩下的写入播放缓冲区
+   *
+   * 解码器用 AV_FRAME_DATA_SKIP_SAMPLES 给出开头要丢弃的样本数（可能跨越
+   * 多帧）和这一帧结尾要丢弃的样本数，来源是 LAME/iTunSMPB 等无缝播放信息、
+   * ogg 的 granule 或者解码器自己的延迟。从文件开头解码、第一帧却没有这些
+   * 信息时，退回 AVCodecParameters::initial_padding
+   */
+  void _output_frame(const AVFrame* frame) {
+    if (frame->flags & AV_FRAME_FLAG_DISCARD) return;
+
+    ma_uint32 end = frame->nb_samples;
+    AVFrameSideData* side =
+        av_frame_get_side_data(frame, AV_FRAME_DATA_SKIP_SAMPLES);
+    if (side != nullptr && side->size >= 10) {
+      skipFrames += AV_RL32(side->data);
+      end -= std::min<ma_uint32>(end, AV_RL32(side->data + 4));
+    } else if (firstFrame && startOfStream &&
+               pCodecParameters->initial_padding > 0) {
+      skipFrames = pCodecParameters->initial_padding;
+    }
+    firstFrame = false;
+
+    ma_uint32 begin = (ma_uint32)std::min<ma_uint64>(skipFrames, end);
+    skipFrames -= begin;
+    if (startOfStream && !primingKnown) {
+      primingFrames += begin;
+      primingKnown = begin < end;
+    }
+
+    if (ranged) {
+      _convert_range(frame, begin, end);
+    } else if (begin < end) {
+      _convert_frame(frame, begin, end - begin);
+    }
+  }
+
+  /**
+   * 取出解码器中所有已经解码的帧
+   */
+  void _receive_frames() {
+    while (avcodec_receive_frame(pCodecContext, pFrame) >= 0) {
+      decodedFrames++;
+      _output_frame(pFrame);
+      av_frame_unref(pFrame);
+    }
+  }
+
+  /**
+   * 把一个音频包发送给解码器，解码出的帧写入播放缓冲区
+   *
+   * return
+   * false 解码出错
+   */
+  bool _send_packet(AVPacket* packet) {
+    // 将原始包发送到解码器上下文
+    if (avcodec_send_packet(pCodecContext, packet) < 0) return false;
+    _receive_frames();
+    return true;
+  }
+
+  /**
+   * 文件结束：发送空包让解码器输出缓存的最后几帧，再取出 SwrContext 中的样本，
+   * 否则音轨结尾会丢失一部分
+   */
+  void _drain() {
+    if (avcodec_send_packet(pCodecContext, NULL) >= 0) _receive_frames();
+    _flush_swr();
+  }
+
+  /**
+   * 从头顺序解复用时，每隔 indexInterval 把音频包的时间戳和字节位置记入包索引
+   */
+  void _index_packet(const AVPacket* packet) {
+    if (!indexing || packet->pos < 0) return;
+
+    int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    if (ts == AV_NOPTS_VALUE) return;
+    if (!packetIndex.empty() && ts < packetIndex.back().pts + indexInterval)
+      return;
+    packetIndex.push_back({ts, packet->pos});
+  }
+
+  /**
+   * 解复用到文件结尾时保存包索引，之后打开同一个文件不再需要记录；
+   * 解码出错提前结束时丢弃不完整的索引。调用时解复用线程必须已经退出，
+   * 或者已经设置 demuxEnd
+   */
+  void _index_store() {
+    if (!indexing) return;
+    indexing = false;
+    if (!demuxEnd.load()) {
+      packetIndex.clear();
+      return;
+    }
+    indexComplete = true;
+    if (!indexKey.empty() && !packetIndex.empty())
+      bgm_index_store(indexDirectory, indexKey, audio_stream_index,
+                      packetIndex);
+  }
+
+  /**
+   * 后台线程：单独打开文件，只读取包不解码，记录完整的包索引，
+   * 完成后保存并替换 packetIndex。indexStop 时放弃
+   */
+  void _index_scan(int streamIndex, AVCodecID codecId) {
+    AVFormatContext* fmt = nullptr;
+    AVPacket* packet = av_packet_alloc();
+    std::vector<bgm_index_entry> entries;
+
+    bool ok = packet != nullptr &&
+              avformat_open_input(&fmt, indexUrl.c_str(), NULL, NULL) == 0;
+    // 没有文件头的封装在 avformat_find_stream_info 中才创建流
+    if (ok && (unsigned)streamIndex >= fmt->nb_streams)
+      ok = avformat_find_stream_info(fmt, NULL) >= 0;
+    ok = ok && (unsigned)streamIndex < fmt->nb_streams &&
+         fmt->streams[streamIndex]->codecpar->codec_id == codecId;
+
+    int r = 0;
+    while (ok && !indexStop.load() && (r = av_read_frame(fmt, packet)) >= 0) {
+      int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+      if (packet->stream_index == streamIndex && packet->pos >= 0 &&
+          ts != AV_NOPTS_VALUE &&
+          (entries.empty() || ts >= entries.back().pts + indexInterval))
+        entries.push_back({ts, packet->pos});
+      av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&fmt);
+    if (!ok || r != AVERROR_EOF || entries.empty()) return;
+
+    if (!indexKey.empty())
+      bgm_index_store(indexDirectory, indexKey, streamIndex, entries);
+    std::lock_guard<std::mutex> lock(indexMutex);
+    packetIndex = std::move(entries);
+    indexComplete = true;
+  }
+
+  /**
+   * 顺序记录被 seek 打断时启动 _index_scan，每个文件只启动一次
+   */
+  void _index_scan_start() {
+    if (indexUrl.empty() || indexThread.joinable()) return;
+    indexStop = false;
+    try {
+      indexThread = std::thread(
+          [this, streamIndex = audio_stream_index,
+           codecId = pCodecParameters->codec_id] {
+            _index_scan(streamIndex, codecId);
+          });
+    } catch (const std::system_error&) {
+      // 没有后台索引时 seek 退回 av_seek_frame
+    }
+  }
+
+  /**
+   * 停止并等待后台建立索引的线程
+   */
+  void _index_scan_stop() {
+    indexStop = true;
+    if (indexThread.joinable()) indexThread.join();
+  }
+
+  /**
+   * 取得下一个包（解复用线程在运行时从包队列中取）并解码
+   *
+   * return
+   * false 文件结束或者出错
+   */
+  bool _decode_packet() {
+    if (demuxing) {
+      AVPacket* packet = packetQueue.acquire_read();
+      if (packet == nullptr) return false;
+      bool ok = _send_packet(packet);
+      packetQueue.commit_read();
+      return ok;
+    }
+
+    int r = av_read_frame(pFormatContext, pPacket);
+    if (r < 0) {
+      if (r == AVERROR_EOF) demuxEnd = true;
+      return false;
+    }
+    if (pPacket->stream_index == audio_stream_index) _index_packet(pPacket);
+    bool ok = pPacket->stream_index != audio_stream_index ||
+              _send_packet(pPacket);
+    av_packet_unref(pPacket);
+    return ok;
+  }
+
+  /**
+   * 解复用线程：把音频流的包放入包队列，直到文件结束或者队列被 abort
+   */
+  void _demux() {
+    for (;;) {
+      AVPacket* packet = packetQueue.acquire_write();
+      if (packet == nullptr) return;
+      int r = av_read_frame(pFormatContext, packet);
+      if (r < 0) {
+        // 最后一次写入 packetIndex 之后才设置，解码线程看到时可以读取索引
+        if (r == AVERROR_EOF) demuxEnd = true;
+        break;
+      }
+
+      if (packet->stream_index != audio_stream_index) {
+        av_packet_unref(packet);
+        continue;
+      }
+      _index_packet(packet);
+      packetQueue.commit_write();
+    }
+
+    packetQueue.finish();
+  }
+
+  /**
+   * config.demuxThread 打开时启动解复用线程，之后 _decode_packet 从包队列取包
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _demux_start() {
+    demuxEnd = false;
+    if (!config.demuxThread) return BGM_OK;
+    if (!packetQueue.init(config.packetQueueSize)) return BGM_PACKET_ALLOC;
+
+    try {
+      demuxThread = std::thread([this] { _demux(); });
+    } catch (const std::system_error&) {
+      return BGM_THREAD;
+    }
+    demuxing = true;
+
+    return BGM_OK;
+  }
+
+  /**
+   * 停止并等待解复用线程，正在等待包的解码线程也会返回
+   */
+  void _demux_stop() {
+    packetQueue.abort();
+    if (demuxThread.joinable()) demuxThread.join();
+    if (demuxing) packetQueue.uninit();
+    demuxing = false;
+  }
+
+  /**
+   * 单独打开 url，只解码样本位置在 [start, end) 之间的部分到 PCM 缓冲区。
+   * 从 start 之前 pre-roll 的位置开始解码，让解码器的重叠窗口、
+   * bit reservoir 等状态恢复后再保留样本
+   *
+   * return
+   * 0 ok，BGM_SEEK 表示无法得到从 start 开始、连续到 end 的样本
+   */
+  bgm_result _decode_range(std::string_view url, int64_t start, int64_t end) {
+    bgm_result ret = BGM_OK;
+    if ((ret = _open_src(url)) != BGM_OK) return ret;
+    if ((ret = _decoder_init()) != BGM_OK) return ret;
+
+    indexing = false;
+    ranged = true;
+    rangeStart = start;
+    rangeEnd = end;
+    rangeFirst = -1;
+    framePosition = 0;
+    framePositionFallback = false;
+
+    if (start > 0) {
+      AVStream* stream = pFormatContext->streams[audio_stream_index];
+      int64_t preroll = std::max<int64_t>(pCodecParameters->seek_preroll,
+                                          srcSampleRate / 10);
+      int64_t ts = av_rescale_q(std::max<int64_t>(start - preroll, 0),
+                                av_make_q(1, srcSampleRate), stream->time_base);
+      if (stream->start_time != AV_NOPTS_VALUE) ts += stream->start_time;
+
+      if (av_seek_frame(pFormatContext, audio_stream_index, ts,
+                        AVSEEK_FLAG_BACKWARD) < 0)
+        return BGM_SEEK;
+      avcodec_flush_buffers(pCodecContext);
+      startOfStream = false;
+    }
+
+    while (!decodeStop.load() && framePosition < rangeEnd &&
+           _decode_packet()) {
+    }
+    if (!decodeStop.load() && framePosition < rangeEnd) _drain();
+
+    // 拼接处不能有缺口：必须从 start 开始，并且（除了最后一段）解码到 end。
+    // 第一段从文件开头解码，和单线程解码一样保留开头所有的样本
+    if ((start > 0 && rangeFirst != start) ||
+        (end != INT64_MAX && framePosition < end))
+      return BGM_SEEK;
+    if (decodeStop.load()) return BGM_PCM_ALLOC;
+    return BGM_OK;
+  }
+
+  /**
+   * 按流或者容器记录的时长估算输出的总帧数
+   *
+   * return
+   * 0 表示时长未知
+   */
+  int64_t _duration_frames() const {
+    AVStream* stream = pFormatContext->streams[audio_stream_index];
+    if (stream->duration != AV_NOPTS_VALUE)
+      return av_rescale_q(stream->duration, stream->time_base,
+                          av_make_q(1, sampleRate));
+    if (pFormatContext->duration != AV_NOPTS_VALUE)
+      return av_rescale(pFormatContext->duration, sampleRate, AV_TIME_BASE);
+    return 0;
+  }
+
+  /**
+   * 把音频切成 config.decodeThreads 段并行解码，再按顺序拼接到 PCM 缓冲区
+   *
+   * return
+   * 0 ok，其他值表示需要退回单线程解码
+   */
+  bgm_result _parallel_decoder(std::string_view url) {
+    if (pFormatContext->pb == nullptr ||
+        !(pFormatContext->pb->seekable & AVIO_SEEKABLE_NORMAL))
+      return BGM_SEEK;
+    // 样本位置按解码器的采样率计算，重采样时无法按位置拼接
+    if (sampleRate != srcSampleRate) return BGM_SEEK;
+
+    int64_t total = _duration_frames();
+
+    // 每段至少 10 秒，太短时打开文件和 pre-roll 的开销抵消了并行的收益
+    int64_t n = std::min<int64_t>(config.decodeThreads,
+                                  total / ((int64_t)sampleRate * 10));
+    if (n < 2) return BGM_SEEK;
+
+    bgm_config workerConfig = config;
+    workerConfig.streaming = MA_FALSE;
+    workerConfig.timing = MA_FALSE;
+    workerConfig.decodeThreads = 1;
+    workerConfig.demuxThread = MA_FALSE;
+
+    std::vector<std::unique_ptr<BgmDecoder>> workers;
+    std::vector<bgm_result> results(n, BGM_OK);
+    std::vector<std::thread> threads;
+    for (int64_t i = 0; i < n; i++)
+      workers.push_back(std::make_unique<BgmDecoder>(workerConfig));
+
+    bgm_result ret = BGM_OK;
+    try {
+      for (int64_t i = 0; i < n; i++) {
+        // 最后一段解码到文件结束，不依赖估算的时长
+        int64_t start = i == 0 ? INT64_MIN : total * i / n;
+        int64_t end = i == n - 1 ? INT64_MAX : total * (i + 1) / n;
+        threads.emplace_back([&workers, &results, url, i, start, end] {
+          results[i] = workers[i]->_decode_range(url, start, end);
+        });
+      }
+    } catch (const std::system_error&) {
+      ret = BGM_THREAD;
+    }
+    for (std::thread& t : threads) t.join();
+
+    for (bgm_result r : results)
+      if (ret == BGM_OK) ret = r;
+
+    if (ret == BGM_OK) {
+      ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+      ma_uint64 frames = 0;
+      for (auto& w : workers) frames += w->pcmFrames;
+
+      if ((pcm = (uint8_t*)av_malloc(std::max<ma_uint64>(frames, 1) * bpf)) ==
+          nullptr) {
+        ret = BGM_PCM_ALLOC;
+      } else {
+        for (auto& w : workers) {
+          memcpy(pcm + pcmFrames * bpf, w->pcm, w->pcmFrames * bpf);
+          pcmFrames += w->pcmFrames;
+          decodedFrames += w->decodedFrames.load();
+          decodeAllocations += w->decodeAllocations.load();
+        }
+        pcmCapacity = frames;
+        decodeAllocations++;
+      }
+    }
+
+    for (auto& w : workers) w->uninit();
+    return ret;
+  }
+
+  /**
+   * 解码整个音频到 PCM 缓冲区
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _decoder(std::string_view url) {
+    bgm_result ret = BGM_OK;
+    if ((ret = _decoder_init()) != BGM_OK) return ret;
+
+    pcmFrames = 0;
+    pcmCursor = 0;
+    decodeStop = false;
+
+    // 并行解码失败时 PCM 缓冲区还是空的，直接从头单线程解码
+    if (config.decodeThreads > 1 && _parallel_decoder(url) == BGM_OK)
+      return BGM_OK;
+
+    if ((ret = _demux_start()) != BGM_OK) return ret;
+
+    // 用流中的数据填充数据包
+    while (!decodeStop.load() && _decode_packet()) {
+    }
+    // 解码出错时解复用线程可能还在写入包索引，先等它退出
+    _demux_stop();
+    if (!decodeStop.load()) _drain();
+    _index_store();
+
+    // 只有 PCM 缓冲区分配失败时才会提前停止
+    if (decodeStop.load()) return BGM_PCM_ALLOC;
+    return BGM_OK;
+  }
+
+  /**
+   * 创建环形缓冲区并启动解码线程，边解码边播放
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _stream_decoder() {
+    bgm_result ret = BGM_OK;
+    if ((ret = _decoder_init()) != BGM_OK) return ret;
+
+    ma_uint32 bufferSizeInFrames =
+        sampleRate * config.bufferSizeInMilliseconds / 1000;
+    if (ma_pcm_rb_init(config.format, channels,
+                       bufferSizeInFrames, NULL, NULL, &rb) != MA_SUCCESS)
+      return BGM_RB_INIT;
+    rbInitialized = true;
+
+    // 边播放边写缓存，只有完整解码到文件结尾时才保留
+    if (!cacheKey.empty() && !looping)
+      bgm_cache_begin(&cacheWriter, config.cacheDirectory, cacheKey,
+                      config.format, channels, sampleRate);
+
+    return _stream_start();
+  }
+
+  /**
+   * 启动解复用线程和解码线程，init 和 seek 之后调用
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _stream_start() {
+    bgm_result ret = BGM_OK;
+    if ((ret = _demux_start()) != BGM_OK) return ret;
+
+    decodeStop = false;
+    decodeDone = false;
+    try {
+      decodeThread = std::thread([this] {
+        while (!decodeStop.load() && _decode_packet()) {
+        }
+
+        if (decodeStop.load()) {
+          bgm_cache_abort(&cacheWriter);
+        } else {
+          _drain();
+          // 解复用线程还没有退出，只有它读到文件结尾之后才能访问包索引
+          if (demuxEnd.load()) _index_store();
+          bgm_cache_finish(&cacheWriter, config.cacheSizeInBytes);
+        }
+        decodeDone = true;
+        _signal_progress();
+      });
+    } catch (const std::system_error&) {
+      return BGM_THREAD;
+    }
+
+    return BGM_OK;
+  }
+
+  /**
+   * 停止解复用线程和解码线程，正在写入的磁盘缓存被放弃
+   */
+  void _stream_stop() {
+    decodeStop = true;
+    request_refill();
+    _demux_stop();
+    if (decodeThread.joinable()) decodeThread.join();
+  }
+
+  /**
+   * 把解码位置移动到输出的第 target 帧（解码器的采样率）。
+   *
+   * 包索引中有目标之前的包并且容器支持按字节 seek 时直接跳到那个包，
+   * 否则交给 av_seek_frame 按时间戳查找。都从目标之前 pre-roll 的位置开始解码，
+   * 之后由 _convert_range 丢弃目标之前的样本，得到从 target 开始的准确样本
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _seek(int64_t target) {
+    AVStream* stream = pFormatContext->streams[audio_stream_index];
+    int64_t startTime =
+        stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t position = target + primingFrames;
+    int64_t preroll = std::max<int64_t>(pCodecParameters->seek_preroll,
+                                        srcSampleRate / 10);
+    int64_t from = std::max<int64_t>(position - preroll, 0);
+    int64_t ts = av_rescale_q(from, av_make_q(1, srcSampleRate),
+                              stream->time_base) +
+                 startTime;
+
+    // 最后一个时间戳不大于 ts 的索引项。不完整的索引只记录到了中途，
+    // ts 在最后一项之后很远时跳到那里再解码丢弃到目标比 av_seek_frame 慢得多
+    bgm_index_entry entry{};
+    bool byteSeek = false;
+    {
+      std::lock_guard<std::mutex> lock(indexMutex);
+      auto it = std::upper_bound(
+          packetIndex.begin(), packetIndex.end(), ts,
+          [](int64_t t, const bgm_index_entry& e) { return t < e.pts; });
+      byteSeek = it != packetIndex.begin() &&
+                 (indexComplete || ts <= packetIndex.back().pts + indexInterval) &&
+                 !(pFormatContext->iformat->flags & AVFMT_NO_BYTE_SEEK);
+      if (byteSeek) entry = *(it - 1);
+    }
+
+    int r = byteSeek ? av_seek_frame(pFormatContext, audio_stream_index,
+                                     entry.pos, AVSEEK_FLAG_BYTE)
+                     : av_seek_frame(pFormatContext, audio_stream_index, ts,
+                                     AVSEEK_FLAG_BACKWARD);
+    if (r < 0) return BGM_SEEK;
+
+    avcodec_flush_buffers(pCodecContext);
+    if (swr != nullptr && swr_init(swr) < 0) return BGM_SWR_INIT;
+
+    // 之后的包不再是从头顺序读取的，剩下的索引交给后台线程建立
+    if (indexing) {
+      indexing = false;
+      _index_scan_start();
+    }
+    startOfStream = false;
+    skipFrames = 0;
+    ranged = true;
+    rangeStart = position;
+    rangeEnd = INT64_MAX;
+    rangeFirst = -1;
+    // 按字节 seek 之后的包可能没有时间戳，从索引项的时间戳开始数样本。
+    // 按时间戳 seek 之后的第一帧也可能没有时间戳，假定它从请求的位置开始，
+    // 不能让音轨变成静音
+    framePositionValid = byteSeek;
+    framePositionFallback = true;
+    framePosition =
+        byteSeek ? av_rescale_q(entry.pts - startTime, stream->time_base,
+                                av_make_q(1, srcSampleRate))
+                 : from;
+    return BGM_OK;
+  }
+
+  /**
+   * 从环形缓冲区读取数据，可能需要分两段读取
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 _read_rb(void* pOutput, ma_uint32 frameCount) {
+    ma_uint32 totalRead = 0;
+    while (totalRead < frameCount) {
+      ma_uint32 frames = frameCount - totalRead;
+      void* pRead;
+      if (ma_pcm_rb_acquire_read(&rb, &frames, &pRead) != MA_SUCCESS) break;
+      if (frames == 0) break;
+
+      memcpy(
+          ma_offset_pcm_frames_ptr(pOutput, totalRead, config.format, channels),
+          pRead, frames * ma_get_bytes_per_frame(config.format, channels));
+      ma_pcm_rb_commit_read(&rb, frames);
+      totalRead += frames;
+    }
+
+    if (ma_pcm_rb_available_read(&rb) < ma_pcm_rb_get_subbuffer_size(&rb) / 2)
+      request_refill();
+    return totalRead;
+  }
+
+  /**
+   * 从 PCM 缓冲区读取数据
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 _read_pcm(void* pOutput, ma_uint32 frameCount) {
+    ma_uint64 cursor = pcmCursor.load();
+    ma_uint64 end = _pcm_end();
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+    const uint8_t* data = cacheHit ? cache.pcm : pcm;
+    ma_uint32 totalRead = 0;
+
+    while (totalRead < frameCount) {
+      if (cursor >= end) {
+        if (!looping || loopStart >= end) break;
+        cursor = loopStart;
+      }
+
+      ma_uint32 frames =
+          (ma_uint32)std::min<ma_uint64>(frameCount - totalRead, end - cursor);
+      memcpy((uint8_t*)pOutput + totalRead * bpf, data + cursor * bpf,
+             frames * bpf);
+      cursor += frames;
+      totalRead += frames;
+    }
+
+    pcmCursor = cursor;
+    return totalRead;
+  }
+
+  /**
+   * PCM 缓冲区中播放到的位置，循环时是循环段的结尾
+   */
+  ma_uint64 _pcm_end() const {
+    return looping && loopEnd ? std::min(loopEnd, pcmFrames) : pcmFrames;
+  }
+
+  /**
+   * streaming 模式下循环播放：先从环形缓冲区读完前奏，之后读取常驻的循环段，
+   * 循环段解码完成后回绕到开头
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 _read_loop(void* pOutput, ma_uint32 frameCount) {
+    ma_uint32 totalRead = 0;
+
+    if (!inLoop) {
+      // 先检查 introDone：为 true 时前奏的样本都已经在环形缓冲区中
+      bool intro = introDone.load();
+      totalRead = _read_rb(pOutput, frameCount);
+      if (totalRead == frameCount || !intro) return totalRead;
+      inLoop = true;
+    }
+
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+    while (totalRead < frameCount) {
+      ma_uint64 filled = loopFrames.load();
+      if (loopCursor >= filled) {
+        // 循环段还在解码，等待解码线程
+        if (!decodeDone.load()) break;
+        // 解码结束后 loopFrames 不再变化，重新读取一次再决定是否回绕
+        filled = loopFrames.load();
+        if (loopCursor < filled) continue;
+        if (filled == 0) break;
+        loopCursor = 0;
+        continue;
+      }
+
+      // 在 loopFrames 之后读取，扩容后的缓冲区一定包含 filled 之前的帧
+      const uint8_t* data = loopPcm.load();
+      ma_uint32 frames = (ma_uint32)std::min<ma_uint64>(
+          frameCount - totalRead, filled - loopCursor);
+      memcpy((uint8_t*)pOutput + totalRead * bpf, data + loopCursor * bpf,
+             frames * bpf);
+      loopCursor += frames;
+      totalRead += frames;
+    }
+
+    return totalRead;
+  }
+
+  /**
+   * 确定循环段并在 streaming 模式下分配常驻的循环段缓冲区。
+   * bgm_config 中没有指定循环点时读取 LOOPSTART/LOOPLENGTH 标签，
+   * 命中磁盘缓存时为了读取标签只打开容器的头部
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _loop_init(std::string_view url) {
+    looping = config.looping;
+    loopStart = config.loopStart;
+    loopEnd = config.loopEnd;
+    if (!looping) return BGM_OK;
+
+    if (loopStart == 0 && loopEnd == 0) {
+      AVFormatContext* fmt = pFormatContext;
+      if (fmt == nullptr &&
+          avformat_open_input(&fmt, url.data(), NULL, NULL) != 0)
+        fmt = nullptr;
+
+      int64_t start, end;
+      if (fmt != nullptr && bgm_loop_tags(fmt, &start, &end)) {
+        // 标签是音频采样率下的位置
+        int rate = srcSampleRate;
+        for (unsigned i = 0; rate == 0 && i < fmt->nb_streams; i++)
+          if (fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+            rate = fmt->streams[i]->codecpar->sample_rate;
+        if (rate == 0) rate = sampleRate;
+        loopStart = av_rescale(start, sampleRate, rate);
+        loopEnd = av_rescale(end, sampleRate, rate);
+      }
+      if (fmt != pFormatContext) avformat_close_input(&fmt);
+    }
+    if (loopEnd != 0 && loopEnd <= loopStart) return BGM_LOOP;
+
+    if (!config.streaming || cacheHit) return BGM_OK;
+
+    // 循环到文件结尾时按时长估算缓冲区，多留 1 秒，时长未知时先分配 10 秒。
+    // 估算不准（没有 Xing 头的 VBR MP3、部分 Ogg）时由 _loop_grow 扩容
+    loopCapacity = loopEnd - loopStart;
+    if (loopEnd == 0) {
+      int64_t total = _duration_frames();
+      loopCapacity = total > (int64_t)loopStart
+                         ? total - loopStart + sampleRate
+                         : (ma_uint64)sampleRate * 10;
+    }
+
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+    uint8_t* p = (uint8_t*)av_malloc(loopCapacity * bpf);
+    if (p == nullptr) return BGM_PCM_ALLOC;
+    loopPcm = p;
+    introDone = loopStart == 0;
+    return BGM_OK;
+  }
+
+  /**
+   * 查找磁盘缓存，命中时用缓存文件代替解码
+   *
+   * return
+   * true 命中
+   */
+  bool _cache_open(std::string_view url) {
+    cacheKey.clear();
+    if (config.cacheDirectory == nullptr) return false;
+
+    cacheKey = bgm_cache_key(url, config.format);
+    // 指定了输出的声道数或采样率时缓存的是转换后的样本
+    if (!cacheKey.empty() && (config.channels || config.sampleRate))
+      cacheKey += "|" + std::to_string(config.channels) + "|" +
+                  std::to_string(config.sampleRate);
+    if (cacheKey.empty() ||
+        !bgm_cache_open(&cache, config.cacheDirectory, cacheKey))
+      return false;
+
+    cacheHit = true;
+    channels = cache.channels;
+    sampleRate = cache.sampleRate;
+    pcmFrames = cache.frames;
+    pcmCursor = 0;
+    return true;
+  }
+
+  /**
+   * 把非 streaming 模式下解码完成的 PCM 缓冲区写入磁盘缓存
+   */
+  void _cache_store() {
+    if (cacheKey.empty() ||
+        !bgm_cache_begin(&cacheWriter, config.cacheDirectory, cacheKey,
+                         config.format, channels, sampleRate))
+      return;
+
+    bgm_cache_write(&cacheWriter, pcm, pcmFrames);
+    bgm_cache_finish(&cacheWriter, config.cacheSizeInBytes);
+  }
+
+ public:
+  bgm_config config;
+
+ public:
+  BgmDecoder() : config{bgm_config_init()} {}
+  explicit BgmDecoder(const bgm_config& config) : config{config} {}
+  ~BgmDecoder() { uninit(); }
+
+  /**
+   * 打开 url 并开始解码。streaming 模式下启动解码线程后立即返回，
+   * 否则解码整个音频后返回
+   *
+   * params
+   * url 有音频流的资源
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result init(std::string_view url) {
+    bgm_result ret = BGM_OK;
+
+    if (bgm_av_sample_format(config.format) == AV_SAMPLE_FMT_NONE)
+      return BGM_OUTPUT_FORMAT;
+
+    timing = bgm_timing{};
+    ioStats = bgm_io_stats{};
+    outputStall = 0;
+    decodedFrames = 0;
+    decodeAllocations = 0;
+    decodeDone = false;
+    skipFrames = 0;
+    firstFrame = true;
+    startOfStream = true;
+    primingFrames = 0;
+    primingKnown = false;
+    probeHit = false;
+    _mark(timing.init);
+
+    looping = false;
+    loopFrames = 0;
+    outputPosition = 0;
+    inLoop = false;
+    loopCursor = 0;
+
+    if (_cache_open(url)) {
+      decodeDone = true;
+      if ((ret = _loop_init(url)) != BGM_OK) return ret;
+      _mark(timing.decoder);
+      return ret;
+    }
+
+    if ((ret = _open_src(url)) != BGM_OK) return ret;
+    if ((ret = _loop_init(url)) != BGM_OK) return ret;
+
+    if (config.streaming) {
+      if ((ret = _stream_decoder()) != BGM_OK) return ret;
+    } else {
+      if ((ret = _decoder(url)) != BGM_OK) return ret;
+      decodeDone = true;
+      _decoder_free();
+      _cache_store();
+    }
+    _mark(timing.decoder);
+
+    return ret;
+  }
+
+  /**
+   * 停止解码线程并释放所有资源
+   */
+  void uninit() {
+    _stream_stop();
+    _index_scan_stop();
+    _decoder_free();
+
+    bgm_cache_abort(&cacheWriter);
+    if (cacheHit) bgm_cache_close(&cache);
+    cacheHit = false;
+
+    av_freep(&pcm);
+    pcmFrames = pcmCapacity = 0;
+    av_free(loopPcm.exchange(nullptr));
+    for (uint8_t* p : loopRetired) av_free(p);
+    loopRetired.clear();
+    loopCapacity = 0;
+    if (rbInitialized) ma_pcm_rb_uninit(&rb);
+    rbInitialized = false;
+  }
+
+  /**
+   * 读取输出格式的交错样本，由播放线程调用
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 read_pcm_frames(void* pOutput, ma_uint32 frameCount) {
+    if (config.streaming && !cacheHit)
+      return looping ? _read_loop(pOutput, frameCount)
+                     : _read_rb(pOutput, frameCount);
+    return _read_pcm(pOutput, frameCount);
+  }
+
+  /**
+   * 音轨是否已经全部读完：解码结束并且缓冲区中没有剩余的样本。
+   * 循环播放时只有循环段为空才会结束
+   */
+  bool at_end() {
+    if (!decodeDone.load()) return false;
+    if (config.streaming && !cacheHit) {
+      if (looping && loopFrames.load() > 0) return false;
+      return !rbInitialized || ma_pcm_rb_available_read(&rb) == 0;
+    }
+    if (looping && loopStart < _pcm_end()) return false;
+    return pcmCursor.load() >= pcmFrames;
+  }
+
+  /**
+   * 移动到输出的第 frame 帧，之后 read_pcm_frames 从这一帧开始读取。
+   * 不能和 read_pcm_frames 同时调用
+   *
+   * streaming 模式下停止解码线程，清空环形缓冲区后从新的位置重新开始解码；
+   * 否则只移动 PCM 缓冲区的读取位置
+   *
+   * return
+   * 0 ok，BGM_SEEK 表示 seek 失败，之后的读取会立即结束
+   */
+  bgm_result seek_to_pcm_frame(ma_uint64 frame) {
+    if (!config.streaming || cacheHit) {
+      ma_uint64 end = _pcm_end();
+      if (looping && frame >= end && loopStart < end)
+        frame = loopStart + (frame - loopStart) % (end - loopStart);
+      pcmCursor = std::min<ma_uint64>(frame, pcmFrames);
+      return BGM_OK;
+    }
+    if (pFormatContext == nullptr) return BGM_SEEK;
+
+    ma_uint64 target = frame;
+    if (looping && frame >= loopStart) {
+      ma_uint64 length = loopFrames.load();
+      if (loopEnd != 0) frame = loopStart + (frame - loopStart) %
+                                                (loopEnd - loopStart);
+
+      // 循环段已经完整地在内存中，只移动读取位置
+      if (decodeDone.load() && length > 0) {
+        ma_pcm_rb_reset(&rb);
+        inLoop = true;
+        loopCursor = (frame - loopStart) % length;
+        return BGM_OK;
+      }
+
+      // 接着已经解码的部分继续填充循环段，播放线程等到 frame 被解码后开始读
+      target = loopStart + length;
+      inLoop = true;
+      loopCursor = frame - loopStart;
+    } else if (looping) {
+      // 从前奏重新开始，循环段从头重新填充
+      loopFrames = 0;
+      introDone = false;
+      inLoop = false;
+      loopCursor = 0;
+    }
+
+    _stream_stop();
+    // 已经写入的部分不再是连续的，不能作为缓存
+    bgm_cache_abort(&cacheWriter);
+    ma_pcm_rb_reset(&rb);
+
+    outputPosition = target;
+    bgm_result ret = _seek(av_rescale(target, srcSampleRate, sampleRate));
+    if (ret == BGM_OK) ret = _stream_start();
+    if (ret != BGM_OK) decodeDone = true;
+    return ret;
+  }
+
+  ma_uint32 get_channels() const { return channels; }
+  ma_uint32 get_sample_rate() const { return sampleRate; }
+
+  /**
+   * streaming 模式下解码线程每次写入样本和解码结束时把 signal 加一并
+   * notify_all，读取的线程可以用 signal->wait 代替轮询。必须在 init 之前调用
+   */
+  void set_progress_signal(std::atomic<uint32_t>* signal) { progress = signal; }
+
+  /**
+   * 是否按 bgm_config.looping 循环播放，这样的音轨不会结束
+   */
+  bool is_looping() const { return looping; }
+
+  /**
+   * 样本是否都在内存中（非 streaming 模式或者命中缓存）。
+   * 这时 seek_to_pcm_frame 只移动读取位置，可以在播放线程调用
+   */
+  bool in_memory() const { return !config.streaming || cacheHit; }
+
+  /**
+   * 唤醒等待环形缓冲区空位的解码线程，让它提前补充数据。
+   * 播放线程欠载时调用，没有等待者时不会进入内核
+   */
+  void request_refill() {
+    refill.fetch_add(1);
+    refill.notify_one();
+  }
+
+  /**
+   * 音轨的总帧数（输出的采样率）。非 streaming 模式、命中缓存或者 streaming
+   * 模式下解码完成后是精确值，解码完成之前按容器记录的时长估算
+   *
+   * return
+   * 0 表示时长未知
+   */
+  ma_uint64 get_length() const {
+    if (!config.streaming || cacheHit) return pcmFrames;
+    if (decodeDone.load()) return outputPosition;
+    if (pFormatContext == nullptr) return 0;
+    return (ma_uint64)std::max<int64_t>(_duration_frames(), 0);
+  }
+
+  /**
+   * 获取解码统计，可以在其他线程调用
+   */
+  bgm_decoder_stats get_decoder_stats() const {
+    bgm_decoder_stats stats;
+    stats.frames = decodedFrames.load();
+    stats.allocations = decodeAllocations.load();
+    stats.passthrough = passthrough;
+    stats.cacheHit = cacheHit;
+    stats.probeHit = probeHit;
+    stats.converter = cacheHit      ? "cache"
+                      : passthrough ? "passthrough"
+                      : convert     ? bgm_simd_strings[convertSimd]
+                                    : "swresample";
+    return stats;
+  }
+
+  /**
+   * 获取流水线各阶段的统计，可以在其他线程调用
+   */
+  bgm_pipeline_stats get_pipeline_stats() {
+    bgm_pipeline_stats stats;
+    stats.queue = packetQueue.get_stats();
+    stats.outputFrames =
+        rbInitialized ? ma_pcm_rb_available_read(&rb) : 0;
+    stats.outputCapacity =
+        rbInitialized ? ma_pcm_rb_get_subbuffer_size(&rb) : 0;
+    stats.outputStall = outputStall.load();
+    return stats;
+  }
+
+  /**
+   * 获取预读层的统计，没有打开 readaheadSizeInBytes 时都是 0
+   */
+  bgm_io_stats get_io_stats() const {
+    return readahead ? readahead->get_stats() : ioStats;
+  }
+
+  /**
+   * 获取 init 各阶段的时间戳，需要打开 bgm_config.timing
+   */
+  bgm_timing get_timing() const { return timing; }
+};
+
+/*
+交叉淡化时每次混音的帧数，决定淡化缓冲区的大小
+*/
+#define BGM_FADE_CHUNK 256
+
+/*
+播放设备和播放列表。init 打开第一首音轨并按它的格式创建设备，
+enqueue 追加的音轨由后台线程提前打开并解码（pre-roll），
+播放线程读完当前音轨后在同一次回调中接上下一首，中间没有空隙。
+crossfade 在同一个设备回调里把当前音轨和新音轨按等功率曲线混音
+*/
+class Bgm : public AbstractBgm {
+ private:
+  // current 只由播放线程切换；next 由播放列表线程放入、播放线程取走；
+  // 播放线程把读完的音轨放入 retired，由播放列表线程释放
+  std::atomic<BgmDecoder*> current{nullptr};
+  std::atomic<BgmDecoder*> next{nullptr};
+  std::atomic<BgmDecoder*> retired{nullptr};
+  // 淡入的音轨，由 crossfade 放入，淡化结束后播放线程把它换成 current
+  std::atomic<BgmDecoder*> fading{nullptr};
+
+  // fadeLength 在放入 fading 之前写好；fadePosition 之后只由播放线程修改
+  ma_uint64 fadeLength = 0;
+  ma_uint64 fadePosition = 0;
+  std::vector<ma_uint8> fadeBuffer;  // 淡入音轨的一块样本
+  std::vector<float> fadeGains;      // 一块的淡出和淡入增益
+  bgm_crossfade_proc fadeProc = nullptr;
+
+  // 设备的声道数和采样率，后面的音轨都转换到这个格式
+  ma_uint32 channels = 0;
+  ma_uint32 sampleRate = 0;
+
+  std::deque<std::string> playlist;
+  mutable std::mutex playlistMutex;  // 保护 playlist 和 retired 的释放
+  std::condition_variable playlistCv;
+  std::thread playlistThread;
+  bool playlistStop = false;
+  bool playlistLoading = false;  // 正在打开从 playlist 中取出的音轨
+  // noDevice 时解码线程写入样本、播放列表线程打开或释放音轨后加一，
+  // render 读不到数据时等待它变化
+  std::atomic<uint32_t> renderProgress{0};
+
+  // init 完成，知道了输出的格式，之后才能打开后面的音轨
+  bool outputReady = false;
+
+  ma_device device;
+  bool deviceInitialized = false;
+  ma_context* context = nullptr;  // 共享的 ma_context，没有使用时为 nullptr
+
+  bgm_timing timing{};
+  // play 在控制线程记录，播放线程读取，不能放在 timing 中
+  std::atomic<int64_t> playTime{0};
+  std::atomic<int64_t> firstAudioTime{0};
+  BgmCallbackTelemetry telemetry;
+  std::atomic<ma_uint64> underruns{0};
+  std::atomic<ma_uint64> missingFrames{0};
+
+  friend void data_callback(ma_device* pDevice, void* pOutput,
+                            const void* pInput, ma_uint32 frameCount);
+
+ private:
+  void inline _mark(int64_t& stage) {
+    if (config.timing) stage = bgm_now_ns();
+  }
+
+  /**
+   * 记录第一次输出非静音帧的时间，由播放线程调用
+   */
+  void _mark_first_audio(const void* pOutput, ma_uint32 frameCount) {
+    if (!config.timing || playTime.load(std::memory_order_acquire) == 0 ||
+        firstAudioTime.load() != 0)
+      return;
+
+    const ma_uint8* bytes = (const ma_uint8*)pOutput;
+    ma_uint64 count = (ma_uint64)frameCount *
+                      ma_get_bytes_per_frame(config.format, channels);
+    for (ma_uint64 i = 0; i < count; i++) {
+      if (bytes[i] != 0) {
+        firstAudioTime = bgm_now_ns();
+        return;
+      }
+    }
+  }
+
+  /**
+   * 播放列表线程：释放播完的音轨，下一首的位置空出来时打开并开始解码
+   * 播放列表中的下一首。打开失败的音轨直接跳过
+   */
+  void _playlist() {
+    bgm_config trackConfig = config;
+    trackConfig.channels = channels;
+    trackConfig.sampleRate = sampleRate;
+
+    std::unique_lock<std::mutex> lock(playlistMutex);
+    while (!playlistStop) {
+      if (BgmDecoder* r = retired.exchange(nullptr)) {
+        delete r;
+        _render_notify();
+      }
+
+      if (next.load() == nullptr && !playlist.empty()) {
+        std::string url = std::move(playlist.front());
+        playlist.pop_front();
+        playlistLoading = true;
+        lock.unlock();
+
+        auto d = _new_decoder(trackConfig);
+        if (d->init(url) != BGM_OK) d.reset();
+
+        lock.lock();
+        playlistLoading = false;
+        if (d) next = d.release();
+        _render_notify();
+        continue;
+      }
+
+      // 播放线程不能加锁通知，切换音轨后最多 10ms 内释放旧的音轨
+      playlistCv.wait_for(lock, std::chrono::milliseconds(10));
+    }
+  }
+
+  /**
+   * 创建音轨的解码器，noDevice 时让解码线程通知 render
+   */
+  std::unique_ptr<BgmDecoder> _new_decoder(const bgm_config& trackConfig) {
+    auto d = std::make_unique<BgmDecoder>(trackConfig);
+    if (config.noDevice) d->set_progress_signal(&renderProgress);
+    return d;
+  }
+
+  void _render_notify() {
+    if (!config.noDevice) return;
+    renderProgress.fetch_add(1);
+    renderProgress.notify_all();
+  }
+
+  /**
+   * init 完成后，播放列表不为空时启动播放列表线程
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _playlist_start() {
+    if (playlistThread.joinable() || !outputReady) return BGM_OK;
+
+    try {
+      playlistThread = std::thread([this] { _playlist(); });
+    } catch (const std::system_error&) {
+      return BGM_THREAD;
+    }
+    return BGM_OK;
+  }
+
+  /**
+   * 从当前音轨读取，读完时接着读下一首，由播放线程调用
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 _read_current(void* pOutput, ma_uint32 frameCount) {
+    ma_uint32 framesRead = 0;
+
+    for (;;) {
+      BgmDecoder* d = current.load();
+      if (d == nullptr) break;
+
+      framesRead += d->read_pcm_frames(
+          ma_offset_pcm_frames_ptr(pOutput, framesRead, config.format,
+                                   channels),
+          frameCount - framesRead);
+      if (framesRead == frameCount || !d->at_end()) break;
+
+      // 上一首还没有被释放时先不切换，下一次回调再试
+      BgmDecoder* n = next.load();
+      if (n == nullptr || retired.load() != nullptr) break;
+      next = nullptr;
+      retired = d;
+      current = n;
+    }
+
+    return framesRead;
+  }
+
+  /**
+   * 读取一块音轨，不足的部分填充静音，交叉淡化时两路都必须是完整的一块
+   */
+  void _read_chunk(BgmDecoder* d, void* pOutput, ma_uint32 frameCount) {
+    ma_uint32 framesRead = d ? d->read_pcm_frames(pOutput, frameCount) : 0;
+    ma_silence_pcm_frames(
+        ma_offset_pcm_frames_ptr(pOutput, framesRead, config.format, channels),
+        frameCount - framesRead, config.format, channels);
+  }
+
+  /**
+   * 交叉淡化：当前音轨直接读到输出，淡入的音轨读到 fadeBuffer，
+   * 按块计算增益后混到输出。淡化结束时把淡入的音轨换成 current，
+   * 淡出的音轨交给播放列表线程释放，由播放线程调用
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 _read_crossfade(void* pOutput, ma_uint32 frameCount) {
+    BgmDecoder* in = fading.load();
+    BgmDecoder* out = current.load();
+    float* gainA = fadeGains.data();
+    float* gainB = gainA + BGM_FADE_CHUNK;
+    ma_uint32 framesRead = 0;
+
+    while (framesRead < frameCount && fadePosition < fadeLength) {
+      ma_uint32 n = (ma_uint32)std::min<ma_uint64>(
+          {frameCount - framesRead, BGM_FADE_CHUNK, fadeLength - fadePosition});
+      void* dst = ma_offset_pcm_frames_ptr(pOutput, framesRead, config.format,
+                                           channels);
+
+      _read_chunk(out, dst, n);
+      _read_chunk(in, fadeBuffer.data(), n);
+      bgm_fade_gains(gainA, gainB, fadePosition, fadeLength, n);
+      fadeProc(dst, dst, fadeBuffer.data(), gainA, gainB, n, channels);
+
+      fadePosition += n;
+      framesRead += n;
+    }
+
+    if (framesRead == frameCount) return framesRead;
+
+    // 淡化结束，上一首还没有被释放时先只播放淡入的音轨，下一次回调再切换
+    if (retired.load() == nullptr) {
+      retired = out;
+      current = in;
+      fading = nullptr;
+      return framesRead;
+    }
+
+    return framesRead +
+           in->read_pcm_frames(ma_offset_pcm_frames_ptr(
+                                   pOutput, framesRead, config.format, channels),
+                               frameCount - framesRead);
+  }
+
+  /**
+   * 播放回调读到的帧数不够：剩余部分填充静音。不是因为播放结束时记为一次欠载，
+   * 并唤醒解码线程提前补充数据，由播放线程调用
+   */
+  void _underrun(void* pOutput, ma_uint32 framesRead, ma_uint32 frameCount) {
+    ma_silence_pcm_frames(
+        ma_offset_pcm_frames_ptr(pOutput, framesRead, config.format, channels),
+        frameCount - framesRead, config.format, channels);
+
+    BgmDecoder* d = current.load();
+    if (d == nullptr || (d->at_end() && next.load() == nullptr &&
+                         fading.load() == nullptr))
+      return;
+
+    underruns.store(underruns.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    missingFrames.store(missingFrames.load(std::memory_order_relaxed) +
+                            frameCount - framesRead,
+                        std::memory_order_relaxed);
+    d->request_refill();
+    if (BgmDecoder* f = fading.load()) f->request_refill();
+  }
+
+  /**
+   * 渲染是否已经结束：当前音轨读完，没有淡化，播放列表中也没有等待打开的音轨
+   */
+  bool _render_end() {
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    BgmDecoder* d = current.load();
+    return d == nullptr ||
+           (d->at_end() && fading.load() == nullptr && next.load() == nullptr &&
+            playlist.empty() && !playlistLoading);
+  }
+
+  /**
+   * 初始化 ma_device
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result _ma_device() {
+    ma_device_config deviceConfig;
+    /*
+    解码器是一个数据源，
+    这意味着我们只需使用 ma_data_source_set_looping() 来设置循环状态。
+    我们将在数据回调中使用 ma_data_source_read_pcm_frames() 读取数据
+    */
+    // ma_data_source_set_looping(&decoder, MA_TRUE);
+
+    deviceConfig = ma_device_config_init(ma_device_type_playback);
+    deviceConfig.playback.format = config.format;
+    deviceConfig.playback.channels = channels;
+    deviceConfig.sampleRate = sampleRate;
+    deviceConfig.dataCallback = data_callback;
+    deviceConfig.pUserData = this;
+    deviceConfig.periodSizeInFrames = config.periodSizeInFrames;
+    deviceConfig.periodSizeInMilliseconds = config.periodSizeInMilliseconds;
+    deviceConfig.periods = config.periods;
+    deviceConfig.performanceProfile = config.performanceProfile;
+    deviceConfig.noPreSilencedOutputBuffer = config.noPreSilencedOutputBuffer;
+    deviceConfig.noClip = config.noClip;
+
+    if (config.sharedContext && (context = bgm_context_acquire()) == nullptr)
+      return BGM_CONTEXT_INIT;
+
+    if (ma_device_init(context, &deviceConfig, &device) != MA_SUCCESS)
+      return BGM_DEVICE_INIT;
+    deviceInitialized = true;
+
+    return BGM_OK;
+  };
+
+ public:
+  bool isPlaying = false;
+  bgm_config config;
+
+ public:
+  Bgm() : config{bgm_config_init()} {}
+  explicit Bgm(const bgm_config& config) : config{config} {}
+  // 播放列表线程还在运行时析构会 std::terminate，先停止并释放所有资源
+  ~Bgm() { destroy(); }
+
+  virtual bgm_result init(std::string_view url) override {
+    bgm_result ret = BGM_OK;
+
+    playTime = 0;
+    firstAudioTime = 0;
+    auto d = _new_decoder(config);
+    ret = d->init(url);
+    timing = d->get_timing();
+    if (ret != BGM_OK) return ret;
+
+    channels = d->get_channels();
+    sampleRate = d->get_sample_rate();
+    current = d.release();
+
+    fadeBuffer.resize((size_t)BGM_FADE_CHUNK *
+                      ma_get_bytes_per_frame(config.format, channels));
+    fadeGains.resize(2 * BGM_FADE_CHUNK);
+    if ((fadeProc = bgm_crossfade_find(config.format, config.simd)) == nullptr)
+      fadeProc = bgm_crossfade_find(config.format, bgm_simd_scalar);
+
+    if (!config.noDevice && (ret = _ma_device()) != BGM_OK) return ret;
+    _mark(timing.device);
+
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    outputReady = true;
+    if (!playlist.empty()) ret = _playlist_start();
+    return ret;
+  }
+
+  virtual void destroy() override {
+    if (deviceInitialized) ma_device_uninit(&device);
+    deviceInitialized = false;
+    if (context != nullptr) bgm_context_release();
+    context = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(playlistMutex);
+      playlistStop = true;
+      playlist.clear();
+    }
+    playlistCv.notify_one();
+    if (playlistThread.joinable()) playlistThread.join();
+    playlistStop = false;
+    outputReady = false;
+
+    delete current.exchange(nullptr);
+    delete next.exchange(nullptr);
+    delete retired.exchange(nullptr);
+    delete fading.exchange(nullptr);
+  }
+
+  virtual bgm_result play() override {
+    if (config.timing && playTime.load() == 0)
+      playTime.store(bgm_now_ns(), std::memory_order_release);
+    if (!deviceInitialized || ma_device_start(&device) != MA_SUCCESS)
+      return BGM_PLAY;
+    isPlaying = true;
+    return BGM_OK;
+  }
+
+  virtual bgm_result pause() override {
+    if (!deviceInitialized || ma_device_stop(&device) != MA_SUCCESS)
+      return BGM_PAUSE;
+    isPlaying = false;
+    return BGM_OK;
+  }
+
+  bgm_result inline switch_play_pause() { return isPlaying ? pause() : play(); }
+
+  ma_uint32 get_channels() const { return channels; }
+  ma_uint32 get_sample_rate() const { return sampleRate; }
+
+  virtual bgm_result seek(double seconds) override {
+    return seek_to_pcm_frame((ma_uint64)(std::max(seconds, 0.0) * sampleRate));
+  }
+
+  /**
+   * 跳转到当前音轨的第 frame 帧（设备的采样率）。
+   * 播放中会先停止设备，seek 完成后继续播放
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result seek_to_pcm_frame(ma_uint64 frame) {
+    bool wasPlaying = isPlaying;
+    if (wasPlaying && pause() != BGM_OK) return BGM_PAUSE;
+
+    bgm_result ret = BGM_SEEK;
+    {
+      std::lock_guard<std::mutex> lock(playlistMutex);
+      if (BgmDecoder* d = current.load()) ret = d->seek_to_pcm_frame(frame);
+    }
+
+    if (wasPlaying && play() != BGM_OK) return BGM_PLAY;
+    return ret;
+  }
+
+  /**
+   * 把一首音轨追加到播放列表，在前面的音轨之后无缝播放。
+   * 采样率或声道数和设备不同的音轨会被转换到设备的格式
+   *
+   * params
+   * url 有音频流的资源
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result enqueue(std::string_view url) {
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    playlist.emplace_back(url);
+    return _playlist_start();
+  }
+
+  /**
+   * 在 milliseconds 内从当前音轨交叉淡化到 url，淡出和淡入的增益为
+   * cos/sin 的等功率曲线。新音轨先打开并开始解码，之后两路在同一个设备回调中
+   * 混音，只有淡化期间多一路解码。淡化结束后新音轨成为当前音轨，
+   * 播放列表中剩下的音轨接在它后面
+   *
+   * params
+   * url 有音频流的资源，采样率或声道数和设备不同时会被转换
+   * milliseconds 淡化的时长
+   *
+   * return
+   * 0 ok，BGM_CROSSFADE 表示上一次淡化还没有结束
+   */
+  bgm_result crossfade(std::string_view url, ma_uint32 milliseconds) {
+    if (!outputReady) return BGM_DEVICE_INIT;
+    if (fading.load() != nullptr) return BGM_CROSSFADE;
+
+    bgm_config trackConfig = config;
+    trackConfig.channels = channels;
+    trackConfig.sampleRate = sampleRate;
+
+    auto d = _new_decoder(trackConfig);
+    bgm_result ret = d->init(url);
+    if (ret != BGM_OK) return ret;
+
+    fadeLength =
+        std::max<ma_uint64>((ma_uint64)milliseconds * sampleRate / 1000, 1);
+    fadePosition = 0;
+    fading = d.release();
+
+    // 淡出的音轨由播放列表线程释放
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    return _playlist_start();
+  }
+
+  /**
+   * 不经过设备，在调用的线程中尽可能快地读取播放列表并写入文件，
+   * 经过和播放完全相同的解码、转换、无缝切换和交叉淡化。
+   * 需要打开 bgm_config.noDevice，调用期间当前线程代替播放线程。
+   * 解码线程暂时没有跟上时阻塞等待它的通知而不是写入静音，结果和机器的速度无关
+   *
+   * params
+   * path 扩展名为 .wav 时用 ma_encoder 写 WAV，否则写交错的原始样本
+   * maxFrames 最多渲染的帧数，0 表示到播放列表结尾，循环播放的音轨必须指定
+   * stats 渲染的帧数、耗时和实时倍数，可以为 nullptr
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result render(const char* path, ma_uint64 maxFrames = 0,
+                    bgm_render_stats* stats = nullptr) {
+    if (!outputReady || deviceInitialized) return BGM_RENDER;
+
+    std::string_view name = path;
+    bool wav = name.size() >= 4 && (name.substr(name.size() - 4) == ".wav" ||
+                                    name.substr(name.size() - 4) == ".WAV");
+    ma_encoder encoder;
+    FILE* file = nullptr;
+    if (wav) {
+      ma_encoder_config encoderConfig = ma_encoder_config_init(
+          ma_encoding_format_wav, config.format, channels, sampleRate);
+      if (ma_encoder_init_file(path, &encoderConfig, &encoder) != MA_SUCCESS)
+        return BGM_RENDER;
+    } else if ((file = fopen(path, "wb")) == nullptr) {
+      return BGM_RENDER;
+    }
+
+    const ma_uint32 chunk = 4096;
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, channels);
+    std::vector<ma_uint8> buffer((size_t)chunk * bpf);
+    bgm_result ret = BGM_OK;
+    ma_uint64 total = 0;
+    int64_t begin = bgm_now_ns();
+
+    for (;;) {
+      ma_uint32 want = chunk;
+      if (maxFrames != 0) {
+        if (total >= maxFrames) break;
+        want = (ma_uint32)std::min<ma_uint64>(want, maxFrames - total);
+      }
+
+      // 先读计数再读取，之后的写入一定会让 wait 返回
+      uint32_t seen = renderProgress.load();
+      ma_uint32 n = read_pcm_frames(buffer.data(), want);
+      if (n > 0) {
+        bool ok =
+            wav ? ma_encoder_write_pcm_frames(&encoder, buffer.data(), n,
+                                              NULL) == MA_SUCCESS
+                : fwrite(buffer.data(), bpf, n, file) == n;
+        if (!ok) {
+          ret = BGM_RENDER;
+          break;
+        }
+        total += n;
+      }
+
+      if (n < want) {
+        if (_render_end()) break;
+        renderProgress.wait(seen);
+      }
+    }
+
+    int64_t elapsed = bgm_now_ns() - begin;
+    if (wav) ma_encoder_uninit(&encoder);
+    if (file != nullptr && fclose(file) != 0) ret = BGM_RENDER;
+
+    if (stats != nullptr) {
+      stats->frames = total;
+      stats->seconds = (double)total / sampleRate;
+      stats->elapsed = elapsed / 1e9;
+      stats->realtime = elapsed > 0 ? stats->seconds / stats->elapsed : 0;
+    }
+    return ret;
+  }
+
+  /**
+   * 获取当前音轨的解码统计，可以在其他线程调用
+   */
+  bgm_decoder_stats get_decoder_stats() const {
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    BgmDecoder* d = current.load();
+    return d ? d->get_decoder_stats() : bgm_decoder_stats{};
+  }
+
+  /**
+   * 获取当前音轨流水线各阶段的统计，可以在其他线程调用
+   */
+  bgm_pipeline_stats get_pipeline_stats() {
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    BgmDecoder* d = current.load();
+    bgm_pipeline_stats stats = d ? d->get_pipeline_stats() : bgm_pipeline_stats{};
+    stats.underruns = underruns.load();
+    stats.missingFrames = missingFrames.load();
+    return stats;
+  }
+
+  /**
+   * 获取当前音轨预读层的统计，没有打开 readaheadSizeInBytes 时都是 0
+   */
+  bgm_io_stats get_io_stats() const {
+    std::lock_guard<std::mutex> lock(playlistMutex);
+    BgmDecoder* d = current.load();
+    return d ? d->get_io_stats() : bgm_io_stats{};
+  }
+
+  /**
+   * 获取后端实际分配的设备缓冲区，没有打开设备时都是 0
+   */
+  bgm_device_buffer get_device_buffer() const {
+    if (!deviceInitialized) return bgm_device_buffer{};
+    bgm_device_buffer buffer;
+    buffer.periodSizeInFrames = device.playback.internalPeriodSizeInFrames;
+    buffer.periods = device.playback.internalPeriods;
+    buffer.sampleRate = device.playback.internalSampleRate;
+    buffer.latency = buffer.sampleRate ? (double)buffer.periodSizeInFrames *
+                                             buffer.periods * 1000 /
+                                             buffer.sampleRate
+                                       : 0;
+    return buffer;
+  }
+
+  /**
+   * 获取播放回调的计时统计，需要打开 bgm_config.callbackTelemetry，
+   * 可以在其他线程调用
+   */
+  bgm_callback_stats get_callback_stats() const {
+    return telemetry.get_stats();
+  }
+
+  /**
+   * 获取 init 各阶段的时间戳，需要打开 bgm_config.timing
+   */
+  bgm_timing get_timing() const {
+    bgm_timing result = timing;
+    result.play = playTime.load();
+    result.firstAudio = firstAudioTime.load();
+    return result;
+  }
+
+  /**
+   * 读取设备格式的交错样本，由播放线程调用。交叉淡化时混合两路音轨，
+   * 否则从当前音轨读取，读完时接着读下一首
+   *
+   * return
+   * 实际读取的帧数
+   */
+  ma_uint32 read_pcm_frames(void* pOutput, ma_uint32 frameCount) {
+    ma_uint32 framesRead = 0;
+
+    if (fading.load() != nullptr)
+      framesRead = _read_crossfade(pOutput, frameCount);
+    if (fading.load() == nullptr && framesRead < frameCount)
+      framesRead += _read_current(
+          ma_offset_pcm_frames_ptr(pOutput, framesRead, config.format,
+                                   channels),
+          frameCount - framesRead);
+
+    _mark_first_audio(pOutput, framesRead);
+    return framesRead;
+  }
+};
+
+inline void data_callback(ma_device* pDevice, void* pOutput,
+                          const void* pInput, ma_uint32 frameCount) {
+  Bgm* bgm = (Bgm*)pDevice->pUserData;
+  if (bgm == NULL) {
+    return;
+  }
+
+  int64_t begin = bgm->config.callbackTelemetry ? bgm_now_ns() : 0;
+  ma_uint32 framesRead = bgm->read_pcm_frames(pOutput, frameCount);
+  // 输出缓冲区不一定预先填充了静音，不够的部分必须自己补齐
+  if (framesRead < frameCount) bgm->_underrun(pOutput, framesRead, frameCount);
+  if (begin != 0)
+    bgm->telemetry.record(begin, bgm_now_ns(), frameCount, framesRead,
+                          pDevice->sampleRate);
+
+  (void)pInput;
+}
@@ -0,0 +1,1159 @@
+#define MINIAUDIO_IMPLEMENTATION
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <thread>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bgm.h"
+#include "bgm_mixer.h"
+
+/*
+bgm 性能测试
+
+用法:
+  bgm_bench startup [测试文件目录] [重复次数]
+  bgm_bench format [测试文件目录] [重复次数]
+  bgm_bench convert [帧数] [重复次数]
+  bgm_bench parallel [测试文件目录] [重复次数] [线程数]
+  bgm_bench cache [测试文件目录] [重复次数]
+  bgm_bench io [测试文件目录] [重复次数] [预读 MB]
+  bgm_bench pipeline [测试文件目录] [重复次数]
+  bgm_bench probe [测试文件目录] [重复次数]
+  bgm_bench seek [测试文件目录] [seek 次数]
+  bgm_bench mixer [路数] [重复次数]
+  bgm_bench context [实例数] [重复次数]
+  bgm_bench decode [测试文件目录] [重复次数] [预热次数]
+  bgm_bench callback [测试文件目录] [播放秒数] [周期毫秒数]
+
+测试用的音频文件由 ffmpeg 编码器在本地生成，已经存在的文件不会重新生成
+*/
+
+typedef struct {
+  const char* name;     /*测试文件名，不含扩展名*/
+  const char* encoder;  /*ffmpeg 编码器名字*/
+  const char* ext;      /*扩展名，用来推断封装格式*/
+  int sampleRate;
+  int channels;
+  int seconds;
+  bool noise; /*白噪声代替正弦波，压缩率和解码开销接近最坏情况*/
+} bench_material;
+
+static const bench_material bench_materials[] = {
+    {"wav-s16-44k-2ch-10s", "pcm_s16le", "wav", 44100, 2, 10, false},
+    {"wav-s16-22k-1ch-30s", "pcm_s16le", "wav", 22050, 1, 30, false},
+    {"flac-48k-2ch-30s", "flac", "flac", 48000, 2, 30, false},
+    {"flac-48k-2ch-300s", "flac", "flac", 48000, 2, 300, false},
+    {"mp3-44k-2ch-60s", "libmp3lame", "mp3", 44100, 2, 60, false},
+    {"aac-48k-2ch-60s", "aac", "m4a", 48000, 2, 60, false},
+    {"vorbis-44k-2ch-60s", "libvorbis", "ogg", 44100, 2, 60, false},
+    {"opus-48k-2ch-60s", "libopus", "opus", 48000, 2, 60, false},
+    {"flac-44k-1ch-30s", "flac", "flac", 44100, 1, 30, false},
+    {"flac-96k-2ch-30s", "flac", "flac", 96000, 2, 30, false},
+    {"flac-48k-6ch-30s", "flac", "flac", 48000, 6, 30, false},
+    {"flac-48k-2ch-30s-noise", "flac", "flac", 48000, 2, 30, true},
+    {"mp3-44k-2ch-60s-noise", "libmp3lame", "mp3", 44100, 2, 60, true},
+};
+
+/**
+ * 把一帧送入编码器，并把得到的包写入文件
+ *
+ * params
+ * frame 为 NULL 时冲刷编码器
+ */
+static bool bench_encode(AVCodecContext* enc, AVFrame* frame,
+                         AVFormatContext* oc, AVStream* st, AVPacket* pkt) {
+  if (avcodec_send_frame(enc, frame) < 0) return false;
+
+  int ret;
+  while ((ret = avcodec_receive_packet(enc, pkt)) >= 0) {
+    av_packet_rescale_ts(pkt, enc->time_base, st->time_base);
+    pkt->stream_index = st->index;
+    if (av_interleaved_write_frame(oc, pkt) < 0) return false;
+  }
+
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+/**
+ * 用 ma_waveform 生成正弦波（或者用 ma_noise 生成白噪声），编码后写入 path
+ *
+ * return
+ * false 编码器不可用或者写入失败
+ */
+static bool bench_generate(const bench_material& m, const std::string& path) {
+  const AVCodec* codec = avcodec_find_encoder_by_name(m.encoder);
+  if (codec == nullptr) return false;
+
+  AVFormatContext* oc = nullptr;
+  if (avformat_alloc_output_context2(&oc, NULL, NULL, path.c_str()) < 0)
+    return false;
+
+  bool ok = false;
+  AVStream* st = avformat_new_stream(oc, NULL);
+  AVCodecContext* enc = avcodec_alloc_context3(codec);
+  AVPacket* pkt = av_packet_alloc();
+  AVFrame* frame = av_frame_alloc();
+  SwrContext* swr = nullptr;
+  int64_t layout = av_get_default_channel_layout(m.channels);
+
+  ma_waveform sine;
+  ma_waveform_config sineConfig = ma_waveform_config_init(
+      ma_format_f32, m.channels, m.sampleRate, ma_waveform_type_sine, 0.5, 440);
+  ma_waveform_init(&sineConfig, &sine);
+  ma_noise noise;
+  ma_noise_config noiseConfig =
+      ma_noise_config_init(ma_format_f32, m.channels, ma_noise_type_white,
+                           (ma_int32)m.sampleRate, 0.5);
+  ma_noise_init(&noiseConfig, NULL, &noise);
+
+  do {
+    if (st == nullptr || enc == nullptr || pkt == nullptr || frame == nullptr)
+      break;
+
+    enc->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0]
+                                         : AV_SAMPLE_FMT_S16;
+    enc->sample_rate = m.sampleRate;
+    enc->channels = m.channels;
+    enc->channel_layout = layout;
+    enc->bit_rate = 64000 * m.channels;
+    enc->time_base = av_make_q(1, m.sampleRate);
+    enc->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+      enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if (avcodec_open2(enc, codec, NULL) < 0) break;
+    if (avcodec_parameters_from_context(st->codecpar, enc) < 0) break;
+    st->time_base = enc->time_base;
+
+    if (!(oc->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&oc->pb, path.c_str(), AVIO_FLAG_WRITE) < 0)
+      break;
+    if (avformat_write_header(oc, NULL) < 0) break;
+
+    swr = swr_alloc_set_opts(NULL, layout, enc->sample_fmt, m.sampleRate,
+                             layout, AV_SAMPLE_FMT_FLT, m.sampleRate, 0, NULL);
+    if (swr == nullptr || swr_init(swr) < 0) break;
+
+    // 固定帧长的编码器（aac、mp3、opus）必须按 frame_size 送帧
+    int frameSize = (enc->frame_size > 0 &&
+                     !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+                        ? enc->frame_size
+                        : 1024;
+    frame->nb_samples = frameSize;
+    frame->format = enc->sample_fmt;
+    frame->channel_layout = layout;
+    frame->channels = m.channels;
+    frame->sample_rate = m.sampleRate;
+    if (av_frame_get_buffer(frame, 0) < 0) break;
+
+    std::vector<float> pcm((size_t)frameSize * m.channels);
+    int64_t total = (int64_t)m.sampleRate * m.seconds;
+    int64_t pts = 0;
+    ok = true;
+    while (ok && pts < total) {
+      if (m.noise)
+        ma_noise_read_pcm_frames(&noise, pcm.data(), frameSize, NULL);
+      else
+        ma_waveform_read_pcm_frames(&sine, pcm.data(), frameSize, NULL);
+      if (av_frame_make_writable(frame) < 0) {
+        ok = false;
+        break;
+      }
+
+      const uint8_t* in[] = {(const uint8_t*)pcm.data()};
+      frame->nb_samples =
+          swr_convert(swr, frame->data, frameSize, in, frameSize);
+      frame->pts = pts;
+      pts += frameSize;
+      ok = bench_encode(enc, frame, oc, st, pkt);
+    }
+
+    ok = ok && bench_encode(enc, NULL, oc, st, pkt);
+    ok = ok && av_write_trailer(oc) == 0;
+  } while (0);
+
+  ma_waveform_uninit(&sine);
+  ma_noise_uninit(&noise, NULL);
+  swr_free(&swr);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  avcodec_free_context(&enc);
+  if (!(oc->oformat->flags & AVFMT_NOFILE)) avio_closep(&oc->pb);
+  avformat_free_context(oc);
+
+  if (!ok) std::filesystem::remove(path);
+  return ok;
+}
+
+/**
+ * 准备测试文件，返回可用文件的路径，编码器不可用的会被跳过
+ */
+static std::vector<std::pair<const bench_material*, std::string>>
+bench_prepare(const std::string& dir) {
+  std::vector<std::pair<const bench_material*, std::string>> files;
+  std::filesystem::create_directories(dir);
+
+  for (const bench_material& m : bench_materials) {
+    std::string path = dir + "/" + m.name + "." + m.ext;
+    if (!std::filesystem::exists(path) && !bench_generate(m, path)) {
+      fprintf(stderr, "skip %s: encoder %s not available\n", m.name,
+              m.encoder);
+      continue;
+    }
+    files.emplace_back(&m, path);
+  }
+
+  return files;
+}
+
+static double bench_median(std::vector<double> values) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+/**
+ * 第 p 百分位（0-100），样本较少时取最接近的一个
+ */
+static double bench_percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t i = (size_t)std::ceil(p / 100 * values.size());
+  return values[std::min(values.size() - 1, i ? i - 1 : 0)];
+}
+
+static double bench_ms(int64_t from, int64_t to) {
+  return (from == 0 || to == 0) ? 0 : (to - from) / 1e6;
+}
+
+/**
+ * Bgm::init 各阶段耗时以及 play 到第一次出声的时间
+ */
+static int bench_startup(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+
+  printf("%-24s %-6s %10s %10s %10s %10s %10s %10s %10s  %s\n", "file",
+         "mode", "open", "find_info", "codec", "decoder", "device",
+         "first_aud", "total", "allocs/frames");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    for (ma_bool32 streaming : {MA_TRUE, MA_FALSE}) {
+      // 每一列是一个阶段，单位毫秒
+      std::vector<double> stages[7];
+      bgm_decoder_stats stats{};
+
+      for (int i = 0; i < repetitions; i++) {
+        bgm_config config = bgm_config_init();
+        config.streaming = streaming;
+        config.timing = MA_TRUE;
+
+        Bgm bgm(config);
+        bgm_result ret = bgm.init(path);
+        if (ret == BGM_OK) ret = bgm.play();
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          bgm.destroy();
+          break;
+        }
+
+        for (int wait = 0; wait < 5000 && bgm.get_timing().firstAudio == 0;
+             wait++)
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        bgm_timing t = bgm.get_timing();
+        stats = bgm.get_decoder_stats();
+        bgm.destroy();
+
+        stages[0].push_back(bench_ms(t.init, t.openInput));
+        stages[1].push_back(bench_ms(t.openInput, t.findStreamInfo));
+        stages[2].push_back(bench_ms(t.findStreamInfo, t.codecOpen));
+        stages[3].push_back(bench_ms(t.codecOpen, t.decoder));
+        stages[4].push_back(bench_ms(t.decoder, t.device));
+        stages[5].push_back(bench_ms(t.play, t.firstAudio));
+        stages[6].push_back(bench_ms(t.init, t.firstAudio));
+      }
+
+      printf("%-24s %-6s", m->name, streaming ? "stream" : "full");
+      for (auto& stage : stages) printf(" %10.3f", bench_median(stage));
+      printf("  %llu/%llu\n", (unsigned long long)stats.allocations,
+             (unsigned long long)stats.frames);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * s16 和 f32 输出管线每秒音频消耗的 CPU 时间
+ *
+ * decode 是整个文件解码并转换到设备格式的耗时（单线程，用 init 的
+ * codecOpen 到 decoder 阶段计时）；device 是设备后端以 f32 混音时
+ * miniaudio 还需要做的格式转换，用 ma_convert_pcm_frames_format 模拟
+ */
+static int bench_format(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+
+  printf("%-24s %-4s %14s %14s %14s\n", "file", "fmt", "decode ms/s",
+         "device ms/s", "total ms/s");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    for (ma_format format : {ma_format_s16, ma_format_f32}) {
+      std::vector<double> decode, device;
+
+      for (int i = 0; i < repetitions; i++) {
+        bgm_config config = bgm_config_init();
+        config.streaming = MA_FALSE;
+        config.timing = MA_TRUE;
+        config.format = format;
+
+        Bgm bgm(config);
+        bgm_result ret = bgm.init(path);
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          bgm.destroy();
+          break;
+        }
+
+        bgm_timing t = bgm.get_timing();
+        decode.push_back(bench_ms(t.codecOpen, t.decoder) / m->seconds);
+
+        // 取出解码结果，模拟设备线程把它转换为 f32
+        std::vector<ma_uint8> pcm;
+        ma_uint32 bpf = ma_get_bytes_per_frame(format, m->channels);
+        ma_uint8 chunk[4096 * 8 * 4];
+        ma_uint32 frames;
+        while ((frames = bgm.read_pcm_frames(chunk, sizeof(chunk) / bpf)) > 0)
+          pcm.insert(pcm.end(), chunk, chunk + frames * bpf);
+        bgm.destroy();
+
+        ma_uint64 frameCount = pcm.size() / bpf;
+        std::vector<float> out(frameCount * m->channels);
+        int64_t begin = bgm_now_ns();
+        if (format != ma_format_f32)
+          ma_convert_pcm_frames_format(out.data(), ma_format_f32, pcm.data(),
+                                       format, frameCount, m->channels,
+                                       ma_dither_mode_none);
+        device.push_back(bench_ms(begin, bgm_now_ns()) / m->seconds);
+      }
+
+      double d = bench_median(decode), c = bench_median(device);
+      printf("%-24s %-4s %14.3f %14.3f %14.3f\n", m->name,
+             format == ma_format_f32 ? "f32" : "s16", d, c, d + c);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * 各种编码、声道数和采样率的解码 + 转换吞吐量，对比输出格式和转换路径。
+ * 非 streaming、单线程（解复用和解码在同一个线程，不分段并行）、mmap 读取、
+ * 不预读、不使用解码缓存和探测缓存，计时从 avcodec_open2 完成到整个文件
+ * 解码并转换到输出格式为止。先预热再重复，报告中位数和 p99
+ */
+static int bench_decode(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 10;
+  int warmup = argc > 2 ? std::max(0, atoi(argv[2])) : 2;
+
+  static const struct {
+    ma_format format;
+    bgm_simd simd;
+    ma_bool32 kernels;
+  } paths[] = {
+      {ma_format_s16, bgm_simd_best, MA_TRUE},
+      {ma_format_s16, bgm_simd_scalar, MA_TRUE},
+      {ma_format_s16, bgm_simd_best, MA_FALSE},
+      {ma_format_f32, bgm_simd_best, MA_TRUE},
+      {ma_format_f32, bgm_simd_best, MA_FALSE},
+  };
+
+  printf("%-24s %-4s %-12s %12s %12s %12s\n", "file", "fmt", "converter",
+         "Mframes/s", "ns/sample", "p99 ns/smp");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    for (auto& p : paths) {
+      std::vector<double> ns;
+      std::string_view converter;
+
+      for (int i = 0; i < warmup + repetitions; i++) {
+        bgm_config config = bgm_config_init();
+        config.streaming = MA_FALSE;
+        config.timing = MA_TRUE;
+        config.format = p.format;
+        config.simd = p.simd;
+        config.convertKernels = p.kernels;
+        // 固定其他会影响解码路径的选项，结果不随默认值变化
+        config.demuxThread = MA_FALSE;
+        config.decodeThreads = 1;
+        config.mmapInput = MA_TRUE;
+        config.readaheadSizeInBytes = 0;
+        config.cacheDirectory = nullptr;
+        config.probeDirectory = nullptr;
+        config.looping = MA_FALSE;
+
+        BgmDecoder d(config);
+        bgm_result ret = d.init(path);
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          break;
+        }
+
+        bgm_timing t = d.get_timing();
+        double samples = (double)d.get_length() * d.get_channels();
+        converter = d.get_decoder_stats().converter;
+        if (i >= warmup && samples > 0)
+          ns.push_back((t.decoder - t.codecOpen) / samples);
+        d.uninit();
+      }
+      if (ns.empty()) continue;
+
+      double median = bench_median(ns);
+      double framesPerSecond = 1e9 / (median * m->channels);
+      printf("%-24s %-4s %-12s %12.2f %12.3f %12.3f\n", m->name,
+             p.format == ma_format_f32 ? "f32" : "s16", converter.data(),
+             framesPerSecond / 1e6, median, bench_percentile(ns, 99));
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * 非 streaming 模式下解码整个文件，返回解码耗时（毫秒），pcm 为解码结果
+ *
+ * return
+ * 小于 0 表示 init 失败
+ */
+static double bench_decode_all(const bench_material& m,
+                               const std::string& path, ma_uint32 threads,
+                               std::vector<ma_uint8>& pcm) {
+  bgm_config config = bgm_config_init();
+  config.streaming = MA_FALSE;
+  config.timing = MA_TRUE;
+  config.decodeThreads = threads;
+
+  Bgm bgm(config);
+  bgm_result ret = bgm.init(path);
+  if (ret != BGM_OK) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), bgm_result2str(ret).data());
+    bgm.destroy();
+    return -1;
+  }
+
+  bgm_timing t = bgm.get_timing();
+  pcm.clear();
+  ma_uint32 bpf = ma_get_bytes_per_frame(config.format, m.channels);
+  ma_uint8 chunk[4096 * 8 * 4];
+  ma_uint32 frames;
+  while ((frames = bgm.read_pcm_frames(chunk, sizeof(chunk) / bpf)) > 0)
+    pcm.insert(pcm.end(), chunk, chunk + frames * bpf);
+  bgm.destroy();
+  return bench_ms(t.codecOpen, t.decoder);
+}
+
+/**
+ * 单线程和分段并行解码整个文件的耗时对比
+ *
+ * exact 表示并行解码拼接后的结果和单线程解码逐位相同
+ */
+static int bench_parallel(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+  ma_uint32 threads =
+      argc > 2 ? std::max(2, atoi(argv[2]))
+               : std::max(2u, std::thread::hardware_concurrency());
+  int failed = 0;
+
+  printf("%-24s %12s %12s %8s  %s\n", "file", "serial ms",
+         "parallel ms", "speedup", "result");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    std::vector<double> serial, parallel;
+    std::vector<ma_uint8> reference, pcm;
+    bool exact = true;
+
+    for (int i = 0; i < repetitions; i++) {
+      double s = bench_decode_all(*m, path, 1, reference);
+      double p = bench_decode_all(*m, path, threads, pcm);
+      if (s < 0 || p < 0) break;
+      serial.push_back(s);
+      parallel.push_back(p);
+      exact = exact && pcm == reference;
+    }
+    if (serial.empty()) continue;
+
+    double s = bench_median(serial), p = bench_median(parallel);
+    printf("%-24s %12.3f %12.3f %7.2fx  %s\n", m->name, s, p,
+           p > 0 ? s / p : 0, exact ? "exact" : "MISMATCH");
+    if (!exact) failed++;
+  }
+
+  printf("threads: %u\n", threads);
+  return failed ? -1 : 0;
+}
+
+/**
+ * 没有磁盘缓存（cold）和命中磁盘缓存（warm）时 init 的耗时，
+ * 非 streaming 模式下 init 包括解码整个文件；cold 也包括写入缓存文件
+ */
+static int bench_cache(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+  std::string cacheDir = dir + "/cache";
+
+  printf("%-24s %-6s %12s %12s %8s\n", "file", "mode", "cold ms",
+         "warm ms", "speedup");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    for (ma_bool32 streaming : {MA_TRUE, MA_FALSE}) {
+      std::vector<double> cold, warm;
+
+      for (int i = 0; i < repetitions * 2; i++) {
+        // 偶数次清空缓存目录，奇数次命中上一次写入的缓存
+        bool hit = i % 2 == 1;
+        if (!hit) std::filesystem::remove_all(cacheDir);
+
+        bgm_config config = bgm_config_init();
+        config.streaming = streaming;
+        config.cacheDirectory = cacheDir.c_str();
+
+        Bgm bgm(config);
+        int64_t begin = bgm_now_ns();
+        bgm_result ret = bgm.init(path);
+        int64_t end = bgm_now_ns();
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          bgm.destroy();
+          break;
+        }
+
+        // streaming 模式下缓存在解码线程读到文件结尾时写入
+        if (!hit && streaming) {
+          std::vector<ma_uint8> chunk(4096 * 8 * 4);
+          ma_uint32 bpf = ma_get_bytes_per_frame(config.format, m->channels);
+          std::string cached = bgm_cache_path(
+              cacheDir, bgm_cache_key(path, config.format));
+          while (!std::filesystem::exists(cached)) {
+            if (bgm.read_pcm_frames(chunk.data(), chunk.size() / bpf) == 0)
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        }
+
+        if (bgm.get_decoder_stats().cacheHit != (ma_bool32)hit) {
+          fprintf(stderr, "%s: unexpected cache %s\n", m->name,
+                  hit ? "miss" : "hit");
+          bgm.destroy();
+          return -1;
+        }
+        bgm.destroy();
+        (hit ? warm : cold).push_back(bench_ms(begin, end));
+      }
+
+      double c = bench_median(cold), w = bench_median(warm);
+      printf("%-24s %-6s %12.3f %12.3f %7.1fx\n", m->name,
+             streaming ? "stream" : "full", c, w, w > 0 ? c / w : 0);
+    }
+  }
+
+  std::filesystem::remove_all(cacheDir);
+  return 0;
+}
+
+/**
+ * ffmpeg 自己的文件 IO、mmap 输入层和后台预读层（bgm_io.h）下，
+ * 非 streaming 模式从 init 开始到解码完整个文件的耗时。
+ * 预读层另外输出命中/未命中次数和等待 IO 线程的总时间
+ */
+static int bench_io(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+  ma_uint32 readahead =
+      argc > 2 ? std::max(1, atoi(argv[2])) * 1024 * 1024 : 8 * 1024 * 1024;
+
+  printf("%-24s %12s %12s %12s  %s\n", "file", "avio ms", "mmap ms",
+         "readahead ms", "hits/misses/stall ms");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    std::vector<double> results[3];
+    bgm_io_stats stats{};
+
+    for (int i = 0; i < repetitions; i++) {
+      for (int mode = 0; mode < 3; mode++) {
+        bgm_config config = bgm_config_init();
+        config.streaming = MA_FALSE;
+        config.timing = MA_TRUE;
+        config.mmapInput = mode == 1;
+        config.readaheadSizeInBytes = mode == 2 ? readahead : 0;
+
+        Bgm bgm(config);
+        bgm_result ret = bgm.init(path);
+        bgm_timing t = bgm.get_timing();
+        if (mode == 2) stats = bgm.get_io_stats();
+        bgm.destroy();
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          break;
+        }
+        results[mode].push_back(bench_ms(t.init, t.decoder));
+      }
+    }
+
+    printf("%-24s %12.3f %12.3f %12.3f  %llu/%llu/%.3f\n", m->name,
+           bench_median(results[0]), bench_median(results[1]),
+           bench_median(results[2]), (unsigned long long)stats.hits,
+           (unsigned long long)stats.misses, stats.stallTime / 1e6);
+  }
+
+  return 0;
+}
+
+/**
+ * 解复用和解码在同一个线程与分成两个线程时，非 streaming 模式解码整个文件
+ * 的耗时，以及包队列的平均填充和两端的等待时间
+ */
+static int bench_pipeline(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+
+  printf("%-24s %12s %12s  %s\n", "file", "serial ms", "threaded ms",
+         "fill/capacity demux_stall decode_stall ms");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    std::vector<double> results[2];
+    bgm_pipeline_stats stats{};
+
+    for (int i = 0; i < repetitions; i++) {
+      for (ma_bool32 demuxThread : {MA_FALSE, MA_TRUE}) {
+        bgm_config config = bgm_config_init();
+        config.streaming = MA_FALSE;
+        config.timing = MA_TRUE;
+        config.demuxThread = demuxThread;
+
+        Bgm bgm(config);
+        bgm_result ret = bgm.init(path);
+        bgm_timing t = bgm.get_timing();
+        if (demuxThread) stats = bgm.get_pipeline_stats();
+        bgm.destroy();
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          break;
+        }
+        results[demuxThread].push_back(bench_ms(t.codecOpen, t.decoder));
+      }
+    }
+
+    printf("%-24s %12.3f %12.3f  %.1f/%u %.3f %.3f\n", m->name,
+           bench_median(results[0]), bench_median(results[1]),
+           stats.queue.fill, stats.queue.capacity,
+           stats.queue.producerStall / 1e6, stats.queue.consumerStall / 1e6);
+  }
+
+  return 0;
+}
+
+/**
+ * avformat_find_stream_info 探测和命中探测缓存（bgm_probe.h）时，
+ * 从 init 开始到打开解码器的耗时，以及其中探测这一步的耗时。
+ * 只打开解码器，不创建播放设备
+ */
+static int bench_probe(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+  std::string probeDir = dir + "/probe";
+
+  printf("%-24s %12s %12s %12s %12s\n", "file", "probe ms", "cached ms",
+         "open ms", "cached open");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    std::vector<double> probe[2], open[2];
+    std::filesystem::remove_all(probeDir);
+
+    // 第一次打开写入探测缓存，不计入结果
+    for (int i = -1; i < repetitions; i++) {
+      for (int cached = 0; cached < 2; cached++) {
+        bgm_config config = bgm_config_init();
+        config.timing = MA_TRUE;
+        config.probeDirectory = cached ? probeDir.c_str() : nullptr;
+
+        BgmDecoder decoder(config);
+        bgm_result ret = decoder.init(path);
+        bgm_timing t = decoder.get_timing();
+        bgm_decoder_stats stats = decoder.get_decoder_stats();
+        decoder.uninit();
+        if (ret != BGM_OK) {
+          fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+          return -1;
+        }
+        if (i < 0) continue;
+        if (stats.probeHit != (ma_bool32)cached) {
+          fprintf(stderr, "%s: unexpected probe cache %s\n", m->name,
+                  cached ? "miss" : "hit");
+          return -1;
+        }
+
+        probe[cached].push_back(bench_ms(t.openInput, t.findStreamInfo));
+        open[cached].push_back(bench_ms(t.init, t.codecOpen));
+      }
+    }
+
+    printf("%-24s %12.3f %12.3f %12.3f %12.3f\n", m->name,
+           bench_median(probe[0]), bench_median(probe[1]),
+           bench_median(open[0]), bench_median(open[1]));
+  }
+
+  std::filesystem::remove_all(probeDir);
+  return 0;
+}
+
+/**
+ * streaming 模式下 seek 到文件后半段的随机位置，直到读出 4096 帧的耗时。
+ * ffmpeg 是没有包索引、交给 av_seek_frame 查找；index 是读取第一次完整
+ * 解码时保存的包索引后直接跳到目标之前的包。
+ *
+ * exact 表示 seek 之后读出的样本和从头解码的结果在同一位置逐位相同
+ */
+static int bench_seek(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  int seeks = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+  std::string probeDir = dir + "/probe";
+  const ma_uint32 frames = 4096;
+  int failed = 0;
+
+  printf("%-24s %12s %12s  %s\n", "file", "ffmpeg ms", "index ms",
+         "result");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    std::vector<ma_uint8> reference;
+    if (bench_decode_all(*m, path, 1, reference) < 0) continue;
+
+    bgm_config config = bgm_config_init();
+    config.probeDirectory = probeDir.c_str();
+    ma_uint32 bpf = ma_get_bytes_per_frame(config.format, m->channels);
+    ma_uint64 total = reference.size() / bpf;
+    if (total < frames * 4) continue;
+
+    std::vector<double> results[2];
+    std::vector<ma_uint8> out(frames * bpf);
+    bool exact = true;
+    std::filesystem::remove_all(probeDir);
+
+    for (int indexed = 0; indexed < 2; indexed++) {
+      // 从头解码到文件结尾，保存包索引
+      if (indexed) {
+        BgmDecoder decoder(config);
+        if (decoder.init(path) != BGM_OK) break;
+        while (!decoder.at_end())
+          if (decoder.read_pcm_frames(out.data(), frames) == 0)
+            std::this_thread::yield();
+      }
+
+      BgmDecoder decoder(config);
+      if (decoder.init(path) != BGM_OK) break;
+
+      std::mt19937_64 rng(total);
+      for (int i = 0; i < seeks; i++) {
+        ma_uint64 target = total / 2 + rng() % (total / 2 - frames);
+        int64_t begin = bgm_now_ns();
+        bgm_result ret = decoder.seek_to_pcm_frame(target);
+
+        ma_uint32 read = 0;
+        while (ret == BGM_OK && read < frames) {
+          ma_uint32 n = decoder.read_pcm_frames(out.data() + read * bpf,
+                                                frames - read);
+          if (n == 0 && decoder.at_end()) break;
+          if (n == 0) std::this_thread::yield();
+          read += n;
+        }
+        results[indexed].push_back(bench_ms(begin, bgm_now_ns()));
+
+        exact = exact && read == frames &&
+                memcmp(out.data(), reference.data() + target * bpf,
+                       frames * bpf) == 0;
+      }
+    }
+
+    printf("%-24s %12.3f %12.3f  %s\n", m->name, bench_median(results[0]),
+           bench_median(results[1]), exact ? "exact" : "MISMATCH");
+    if (!exact) failed++;
+  }
+
+  std::filesystem::remove_all(probeDir);
+  return failed ? -1 : 0;
+}
+
+/**
+ * bgm_convert.h 中的转换内核和 swr_convert_frame 的对比
+ *
+ * 先检查每个 SIMD 版本和标量版本的输出逐位相同（包括不同的起始偏移和
+ * 不足一个向量的尾部），再测量每帧耗时。有不一致时返回 -1
+ */
+static int bench_convert(int argc, char** argv) {
+  int frames = argc > 0 ? std::max(64, atoi(argv[0])) : 1 << 20;
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+  const int channels = 2;
+  int failed = 0;
+
+  static const struct {
+    const char* name;
+    AVSampleFormat in;
+    AVSampleFormat out;
+  } conversions[] = {
+      {"fltp->s16", AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16},
+      {"fltp->f32", AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT},
+      {"s16p->s16", AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16},
+      {"s32p->s16", AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_S16},
+  };
+
+  printf("%-10s %-10s %12s %10s\n", "convert", "impl", "ns/frame", "exact");
+
+  for (auto& conv : conversions) {
+    int inBytes = av_get_bytes_per_sample(conv.in);
+    int outBytes = av_get_bytes_per_sample(conv.out);
+
+    // 输入帧，随机样本加上几个边界值（超出 [-1, 1] 的浮点数用来测试饱和）
+    int64_t layout = av_get_default_channel_layout(channels);
+    AVFrame* in = av_frame_alloc();
+    in->format = conv.in;
+    in->channel_layout = layout;
+    in->channels = channels;
+    in->sample_rate = 48000;
+    in->nb_samples = frames;
+    av_frame_get_buffer(in, 0);
+
+    std::mt19937 rng(frames);
+    for (int c = 0; c < channels; c++) {
+      for (int i = 0; i < frames; i++) {
+        uint8_t* p = in->extended_data[c] + (size_t)i * inBytes;
+        if (conv.in == AV_SAMPLE_FMT_FLTP) {
+          static const float edges[] = {1.0f, -1.0f, 1.5f, -1.5f, 0.0f,
+                                        32767.5f / 32768.0f};
+          std::uniform_real_distribution<float> dist(-1.1f, 1.1f);
+          float x = i < 6 ? edges[i] : dist(rng);
+          memcpy(p, &x, sizeof(x));
+        } else {
+          ma_uint32 x = (ma_uint32)rng();
+          memcpy(p, &x, inBytes);
+        }
+      }
+    }
+
+    size_t outSize = (size_t)frames * channels * outBytes;
+    std::vector<uint8_t> reference(outSize), out(outSize);
+    bgm_convert_find(conv.in, conv.out, bgm_simd_scalar)(
+        reference.data(), in->extended_data, 0, frames, channels);
+
+    for (int simd = bgm_simd_scalar; simd < bgm_simd_best; simd++) {
+      bgm_convert_proc proc =
+          bgm_convert_find(conv.in, conv.out, (bgm_simd)simd);
+      if (proc == nullptr) continue;
+
+      // 起始偏移和长度都取一些不是向量宽度倍数的值
+      bool exact = true;
+      for (int offset : {0, 1, 3, 7}) {
+        for (int count : {0, 1, 5, 15, 17, 33, frames - offset}) {
+          std::fill(out.begin(), out.end(), 0xAB);
+          proc(out.data(), in->extended_data, offset, count, channels);
+          size_t bytes = (size_t)count * channels * outBytes;
+          const uint8_t* expected =
+              reference.data() + (size_t)offset * channels * outBytes;
+          exact = exact && memcmp(out.data(), expected, bytes) == 0 &&
+                  (bytes == outSize || out[bytes] == 0xAB);
+        }
+      }
+      if (!exact) failed++;
+
+      std::vector<double> ns;
+      for (int i = 0; i < repetitions; i++) {
+        int64_t begin = bgm_now_ns();
+        proc(out.data(), in->extended_data, 0, frames, channels);
+        ns.push_back((double)(bgm_now_ns() - begin) / frames);
+      }
+
+      printf("%-10s %-10s %12.3f %10s\n", conv.name,
+             bgm_simd_strings[simd].data(), bench_median(ns),
+             exact ? "yes" : "NO");
+    }
+
+    // swresample，输出帧预先分配好，只测量转换本身
+    SwrContext* swr = swr_alloc_set_opts(NULL, layout, conv.out, 48000, layout,
+                                         conv.in, 48000, 0, NULL);
+    AVFrame* swrOut = av_frame_alloc();
+    swrOut->format = conv.out;
+    swrOut->channel_layout = layout;
+    swrOut->channels = channels;
+    swrOut->sample_rate = 48000;
+    swrOut->nb_samples = frames;
+    if (swr != nullptr && swr_init(swr) >= 0 &&
+        av_frame_get_buffer(swrOut, 0) >= 0) {
+      std::vector<double> ns;
+      for (int i = 0; i < repetitions; i++) {
+        swrOut->nb_samples = frames;
+        int64_t begin = bgm_now_ns();
+        swr_convert_frame(swr, swrOut, in);
+        ns.push_back((double)(bgm_now_ns() - begin) / frames);
+      }
+      printf("%-10s %-10s %12.3f %10s\n", conv.name, "swresample",
+             bench_median(ns), "-");
+    }
+
+    av_frame_free(&swrOut);
+    swr_free(&swr);
+    av_frame_free(&in);
+  }
+
+  if (failed)
+    fprintf(stderr, "%d kernel(s) differ from the scalar reference\n", failed);
+  return failed ? -1 : 0;
+}
+
+/**
+ * 一个核在 10ms 的周期内能混合多少路：每路是循环播放的内存音频，
+ * 只测量读取、乘增益累加和饱和输出。同时检查 SIMD 内核和标量版本的结果一致
+ */
+static int bench_mixer(int argc, char** argv) {
+  int streams = argc > 0 ? std::max(1, atoi(argv[0])) : 64;
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 200;
+  const ma_uint32 channels = 2;
+  const ma_uint32 sampleRate = 48000;
+  const ma_uint32 period = sampleRate / 100;
+  const ma_uint32 length = sampleRate;  // 每路 1 秒，循环播放
+  // 检查结果用的帧数，不是块和向量宽度的倍数，覆盖内核的尾部处理
+  const ma_uint32 checkFrames = BGM_MIX_CHUNK * 2 + 13;
+  int failed = 0;
+
+  printf("%-6s %-10s %8s %12s %12s %10s\n", "format", "impl", "streams",
+         "us/period", "streams/10ms", "exact");
+
+  for (ma_format format : {ma_format_s16, ma_format_f32}) {
+    ma_uint32 bps = ma_get_bytes_per_sample(format);
+    size_t samples = (size_t)length * channels;
+
+    // 满幅度的随机样本，多路叠加后大部分样本会触发饱和
+    std::mt19937 rng(streams);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<std::vector<uint8_t>> data(streams);
+    for (auto& d : data) {
+      d.resize(samples * bps);
+      for (size_t i = 0; i < samples; i++) {
+        if (format == ma_format_f32) {
+          float x = dist(rng);
+          memcpy(&d[i * bps], &x, bps);
+        } else {
+          ma_int16 x = (ma_int16)rng();
+          memcpy(&d[i * bps], &x, bps);
+        }
+      }
+    }
+
+    std::vector<uint8_t> reference;
+    for (int simd = bgm_simd_scalar; simd < bgm_simd_best; simd++) {
+      if (bgm_accumulate_find(format, (bgm_simd)simd) == nullptr) continue;
+
+      bgm_mixer_config config = bgm_mixer_config_init();
+      config.format = format;
+      config.channels = channels;
+      config.sampleRate = sampleRate;
+      config.maxSources = streams;
+      config.simd = (bgm_simd)simd;
+      config.noDevice = MA_TRUE;
+      BgmMixer mixer(config);
+      if (mixer.init() != BGM_OK) {
+        failed++;
+        continue;
+      }
+
+      std::vector<ma_audio_buffer> buffers(streams);
+      for (int i = 0; i < streams; i++) {
+        ma_audio_buffer_config bufferConfig = ma_audio_buffer_config_init(
+            format, channels, length, data[i].data(), NULL);
+        bufferConfig.sampleRate = sampleRate;
+        ma_audio_buffer_init(&bufferConfig, &buffers[i]);
+        ma_data_source_set_looping(&buffers[i], MA_TRUE);
+        if (mixer.add(&buffers[i], 0.25f + 0.75f * i / streams) != BGM_OK)
+          failed++;
+      }
+
+      std::vector<uint8_t> out((size_t)checkFrames * channels * bps);
+      mixer.mix(out.data(), checkFrames);
+      bool exact = reference.empty() || out == reference;
+      if (reference.empty()) reference = out;
+      if (!exact) failed++;
+
+      std::vector<double> us;
+      for (int i = 0; i < repetitions; i++) {
+        int64_t begin = bgm_now_ns();
+        mixer.mix(out.data(), period);
+        us.push_back((bgm_now_ns() - begin) / 1e3);
+      }
+      double median = bench_median(us);
+
+      printf("%-6s %-10s %8d %12.1f %12.0f %10s\n",
+             format == ma_format_s16 ? "s16" : "f32",
+             bgm_simd_strings[simd].data(),
+             streams, median, 10000.0 / (median / streams),
+             exact ? "yes" : "NO");
+
+      for (auto& buffer : buffers) {
+        mixer.remove(&buffer);
+        ma_audio_buffer_uninit(&buffer);
+      }
+    }
+  }
+
+  if (failed)
+    fprintf(stderr, "%d mixer run(s) differ from the scalar reference\n",
+            failed);
+  return failed ? -1 : 0;
+}
+
+/**
+ * 同时创建多个播放设备的耗时：每个设备创建自己的 ma_context 和共用一个
+ * 共享的 ma_context。只打开设备不播放，不需要测试文件
+ */
+static int bench_context(int argc, char** argv) {
+  int players = argc > 0 ? std::max(1, atoi(argv[0])) : 16;
+  int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+
+  printf("%-10s %8s %12s %12s %12s\n", "context", "players", "first ms",
+         "median ms", "total ms");
+
+  for (ma_bool32 shared : {MA_FALSE, MA_TRUE}) {
+    std::vector<double> first, each, total;
+
+    for (int r = 0; r < repetitions; r++) {
+      bgm_mixer_config config = bgm_mixer_config_init();
+      config.maxSources = 1;
+      config.sharedContext = shared;
+
+      // 所有实例同时存在，共享的 context 只在第一个实例创建
+      std::vector<std::unique_ptr<BgmMixer>> mixers;
+      int64_t begin = bgm_now_ns();
+      for (int i = 0; i < players; i++) {
+        int64_t t = bgm_now_ns();
+        auto mixer = std::make_unique<BgmMixer>(config);
+        if (mixer->init() != BGM_OK) {
+          fprintf(stderr, "device init failed\n");
+          return -1;
+        }
+        (i == 0 ? first : each).push_back(bench_ms(t, bgm_now_ns()));
+        mixers.push_back(std::move(mixer));
+      }
+      total.push_back(bench_ms(begin, bgm_now_ns()));
+    }
+
+    printf("%-10s %8d %12.2f %12.2f %12.2f\n", shared ? "shared" : "private",
+           players, bench_median(first), bench_median(each),
+           bench_median(total));
+  }
+
+  return 0;
+}
+
+/**
+ * 通过设备播放每个测试文件，统计播放回调的耗时、抖动和距离截止时间的余量，
+ * 以及欠载的次数和补齐的静音帧数，最后输出所有文件合计的 耗时 / 周期 直方图。
+ * period 是设备每个周期的毫秒数，0 表示后端的默认值
+ */
+static int bench_callback(int argc, char** argv) {
+  std::string dir = argc > 0 ? argv[0] : "bgm_bench_data";
+  double seconds = argc > 1 ? std::max(0.1, atof(argv[1])) : 2;
+  ma_uint32 period = argc > 2 ? (ma_uint32)std::max(0, atoi(argv[2])) : 0;
+  ma_uint64 histogram[BGM_LOAD_BUCKETS] = {};
+  bgm_device_buffer buffer{};
+  int failed = 0;
+
+  printf("%-24s %9s %9s %9s %9s %11s %7s %7s %9s\n", "file", "callbacks",
+         "avg us", "max us", "max load", "jitter us", "misses", "xruns",
+         "missing");
+
+  for (auto& [m, path] : bench_prepare(dir)) {
+    bgm_config config = bgm_config_init();
+    config.callbackTelemetry = MA_TRUE;
+    config.periodSizeInMilliseconds = period;
+
+    Bgm bgm(config);
+    bgm_result ret = bgm.init(path);
+    if (ret == BGM_OK) ret = bgm.play();
+    if (ret != BGM_OK) {
+      fprintf(stderr, "%s: %s\n", m->name, bgm_result2str(ret).data());
+      bgm.destroy();
+      failed++;
+      continue;
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    bgm.pause();
+    bgm_callback_stats stats = bgm.get_callback_stats();
+    bgm_pipeline_stats pipeline = bgm.get_pipeline_stats();
+    buffer = bgm.get_device_buffer();
+    bgm.destroy();
+
+    for (int i = 0; i < BGM_LOAD_BUCKETS; i++)
+      histogram[i] += stats.histogram[i];
+    double n = stats.callbacks ? (double)stats.callbacks : 1;
+    printf("%-24s %9llu %9.1f %9.1f %8.1f%% %11.1f %7llu %7llu %9llu\n",
+           m->name, (unsigned long long)stats.callbacks,
+           stats.durationSum / n / 1e3, stats.durationMax / 1e3,
+           stats.loadMax * 100, stats.jitterMax / 1e3,
+           (unsigned long long)stats.deadlineMisses,
+           (unsigned long long)pipeline.underruns,
+           (unsigned long long)pipeline.missingFrames);
+  }
+
+  printf("\ndevice buffer: %u frames x %u periods @ %u Hz (%.1f ms)\n",
+         buffer.periodSizeInFrames, buffer.periods, buffer.sampleRate,
+         buffer.latency);
+
+  printf("\n%-12s %9s\n", "load", "callbacks");
+  for (int i = 0; i < BGM_LOAD_BUCKETS; i++) {
+    if (i < BGM_LOAD_BUCKETS - 1)
+      printf("%3d%% - %3d%% %9llu\n", i * 10, (i + 1) * 10,
+             (unsigned long long)histogram[i]);
+    else
+      printf("%-12s %9llu\n", ">= 100%", (unsigned long long)histogram[i]);
+  }
+
+  return failed ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+  av_log_set_level(AV_LOG_ERROR);
+
+  std::string_view cmd = argc > 1 ? argv[1] : "";
+  if (cmd == "startup") return bench_startup(argc - 2, argv + 2);
+  if (cmd == "format") return bench_format(argc - 2, argv + 2);
+  if (cmd == "convert") return bench_convert(argc - 2, argv + 2);
+  if (cmd == "parallel") return bench_parallel(argc - 2, argv + 2);
+  if (cmd == "cache") return bench_cache(argc - 2, argv + 2);
+  if (cmd == "io") return bench_io(argc - 2, argv + 2);
+  if (cmd == "pipeline") return bench_pipeline(argc - 2, argv + 2);
+  if (cmd == "probe") return bench_probe(argc - 2, argv + 2);
+  if (cmd == "seek") return bench_seek(argc - 2, argv + 2);
+  if (cmd == "mixer") return bench_mixer(argc - 2, argv + 2);
+  if (cmd == "context") return bench_context(argc - 2, argv + 2);
+  if (cmd == "decode") return bench_decode(argc - 2, argv + 2);
+  if (cmd == "callback") return bench_callback(argc - 2, argv + 2);
+
+  printf(
+      "usage:\n"
+      "\tbgm_bench startup [dir] [repetitions]  Bgm::init stage breakdown\n"
+      "\tbgm_bench format [dir] [repetitions]   s16 vs f32 CPU per second\n"
+      "\tbgm_bench convert [frames] [repetitions] kernels vs swresample\n"
+      "\tbgm_bench parallel [dir] [repetitions] [threads] segmented decode\n"
+      "\tbgm_bench cache [dir] [repetitions]    cold vs warm disk cache\n"
+      "\tbgm_bench io [dir] [repetitions] [MB]  ffmpeg IO vs mmap vs readahead\n"
+      "\tbgm_bench pipeline [dir] [repetitions] demux/decode threads\n"
+      "\tbgm_bench probe [dir] [repetitions]    find_stream_info vs cache\n"
+      "\tbgm_bench seek [dir] [seeks]           av_seek_frame vs packet index\n"
+      "\tbgm_bench mixer [streams] [repetitions] streams mixed per 10ms\n"
+      "\tbgm_bench context [players] [repetitions] shared vs private context\n"
+      "\tbgm_bench decode [dir] [repetitions] [warmup] decode throughput\n"
+      "\tbgm_bench callback [dir] [seconds] [period ms] callback timing\n");
+  return -1;
+}
@@ -0,0 +1,337 @@
+#pragma once
+
+/*
+解码结果的磁盘缓存。
+
+每个缓存文件保存一个音频转换到设备格式后的全部交错样本，文件名是 key 的哈希，
+key 由音频文件的绝对路径、大小、修改时间和输出格式组成，音频文件被修改后
+自然不会再命中。命中时映射整个缓存文件，不需要解码。
+缓存文件的修改时间就是最近使用时间，目录超出大小上限时先删除最久没有使用的。
+同一个音频文件的解码缓存、探测缓存和包索引（bgm_probe.h）文件名的哈希前缀
+相同，一起计入大小、一起删除
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "bgm_mmap.h"
+#include "miniaudio.h"
+
+#define BGM_CACHE_MAGIC "BGMPCM1"
+#define BGM_CACHE_EXT ".pcm"
+
+/*
+缓存 key 中音频文件标识和输出格式等变体之间的分隔符，路径中不会出现 '\0'
+*/
+#define BGM_CACHE_VARIANT '\0'
+
+/*
+超过这个时间没有写入的临时文件是中断的写入留下的，淘汰时删除
+*/
+#define BGM_CACHE_TEMP_AGE std::chrono::hours(1)
+
+/*
+缓存文件的布局：header、key、补齐到 16 字节的 0、交错样本
+*/
+typedef struct {
+  char magic[8];        /*BGM_CACHE_MAGIC*/
+  ma_uint32 format;     /*ma_format*/
+  ma_uint32 channels;   /*声道数*/
+  ma_uint32 sampleRate; /*采样率*/
+  ma_uint32 keySize;    /*key 的字节数，用来排除哈希冲突*/
+  ma_uint64 frames;     /*样本帧数*/
+} bgm_cache_header;
+
+typedef struct {
+  bgm_mmap map;
+  const uint8_t* pcm; /*映射中的交错样本*/
+  ma_uint64 frames;
+  ma_format format;
+  ma_uint32 channels;
+  ma_uint32 sampleRate;
+} bgm_cache_entry;
+
+typedef struct {
+  FILE* file;  /*nullptr 表示没有在写入*/
+  std::string path;  /*缓存文件*/
+  std::string temp;  /*写入中的临时文件，完成后改名为 path*/
+  bgm_cache_header header;
+} bgm_cache_writer;
+
+/**
+ * 样本在缓存文件中的偏移
+ */
+size_t inline bgm_cache_pcm_offset(size_t keySize) {
+  return (sizeof(bgm_cache_header) + keySize + 15) & ~(size_t)15;
+}
+
+/**
+ * 本地文件的标识：绝对路径、大小和修改时间，文件被修改后会变化
+ *
+ * return
+ * url 不是本地文件时返回空字符串
+ */
+std::string inline bgm_file_key(std::string_view url) {
+  std::error_code ec;
+  std::filesystem::path path =
+      std::filesystem::absolute(std::filesystem::path(url), ec);
+  if (ec || !std::filesystem::is_regular_file(path, ec)) return "";
+
+  auto size = std::filesystem::file_size(path, ec);
+  if (ec) return "";
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) return "";
+
+  return path.string() + "|" + std::to_string(size) + "|" +
+         std::to_string(mtime.time_since_epoch().count());
+}
+
+/**
+ * 计算音频文件的缓存 key
+ *
+ * return
+ * url 不是本地文件时返回空字符串
+ */
+std::string inline bgm_cache_key(std::string_view url, ma_format format) {
+  std::string key = bgm_file_key(url);
+  if (key.empty()) return "";
+  return key + BGM_CACHE_VARIANT + ma_get_format_name(format);
+}
+
+/**
+ * FNV-1a 哈希
+ */
+uint64_t inline bgm_cache_hash(std::string_view s) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : s) hash = (hash ^ c) * 1099511628211ull;
+  return hash;
+}
+
+/**
+ * key 对应的缓存文件。文件名是音频文件标识（key 中 BGM_CACHE_VARIANT 之前的
+ * 部分）的哈希，有变体时再加上 "-" 和变体的哈希，最后是扩展名 ext。
+ * 同一个音频文件的所有缓存文件都以相同的 16 位十六进制哈希开头
+ */
+std::string inline bgm_cache_path(const std::string& dir,
+                                  const std::string& key,
+                                  const char* ext = BGM_CACHE_EXT) {
+  std::string_view k = key;
+  size_t split = k.find(BGM_CACHE_VARIANT);
+
+  char name[40];
+  if (split == std::string_view::npos)
+    snprintf(name, sizeof(name), "%016llx",
+             (unsigned long long)bgm_cache_hash(k));
+  else
+    snprintf(name, sizeof(name), "%016llx-%016llx",
+             (unsigned long long)bgm_cache_hash(k.substr(0, split)),
+             (unsigned long long)bgm_cache_hash(k.substr(split + 1)));
+  return (std::filesystem::path(dir) / (name + std::string(ext)))
+      .string();
+}
+
+/**
+ * 查找并映射缓存文件，命中时更新它的最近使用时间
+ *
+ * return
+ * false 没有命中
+ */
+bool inline bgm_cache_open(bgm_cache_entry* entry, const std::string& dir,
+                           const std::string& key) {
+  std::string path = bgm_cache_path(dir, key);
+  if (!bgm_mmap_open(&entry->map, path.c_str())) return false;
+
+  const uint8_t* data = entry->map.data;
+  size_t offset = bgm_cache_pcm_offset(key.size());
+  const bgm_cache_header* header = (const bgm_cache_header*)data;
+
+  bool ok = entry->map.size >= offset &&
+            memcmp(header->magic, BGM_CACHE_MAGIC, 8) == 0 &&
+            header->keySize == key.size() &&
+            memcmp(data + sizeof(bgm_cache_header), key.data(), key.size()) ==
+                0 &&
+            header->channels > 0 &&
+            entry->map.size - offset ==
+                header->frames *
+                    ma_get_bytes_per_frame((ma_format)header->format,
+                                           header->channels);
+  if (!ok) {
+    bgm_mmap_close(&entry->map);
+    return false;
+  }
+
+  entry->pcm = data + offset;
+  entry->frames = header->frames;
+  entry->format = (ma_format)header->format;
+  entry->channels = header->channels;
+  entry->sampleRate = header->sampleRate;
+
+  std::error_code ec;
+  std::filesystem::last_write_time(
+      path, std::filesystem::file_time_type::clock::now(), ec);
+  return true;
+}
+
+/**
+ * 解除缓存文件的映射
+ */
+void inline bgm_cache_close(bgm_cache_entry* entry) {
+  bgm_mmap_close(&entry->map);
+  entry->pcm = nullptr;
+  entry->frames = 0;
+}
+
+/**
+ * 缓存目录超出 maxBytes 时，按最近使用时间从旧到新删除音频文件的所有缓存文件
+ * （解码缓存、探测缓存和包索引），先删除中断的写入留下的临时文件。
+ * 正在被映射的文件在 Windows 上删除会失败，跳过即可
+ */
+void inline bgm_cache_evict(const std::string& dir, ma_uint64 maxBytes) {
+  typedef struct {
+    std::vector<std::pair<std::filesystem::path, ma_uint64>> files;
+    std::filesystem::file_time_type time;  // 最近使用的一个文件
+  } track;
+
+  std::map<std::string, track> tracks;
+  ma_uint64 total = 0;
+  std::error_code ec;
+  auto now = std::filesystem::file_time_type::clock::now();
+
+  for (auto& e : std::filesystem::directory_iterator(dir, ec)) {
+    // 只处理以哈希开头的缓存文件
+    std::string name = e.path().filename().string();
+    if (!e.is_regular_file(ec) || name.size() < 16 ||
+        name.find_first_not_of("0123456789abcdef") < 16)
+      continue;
+    ma_uint64 size = (ma_uint64)e.file_size(ec);
+    if (ec) continue;
+    auto time = e.last_write_time(ec);
+    if (ec) continue;
+
+    if (e.path().extension() == ".tmp") {
+      if (now - time > BGM_CACHE_TEMP_AGE &&
+          std::filesystem::remove(e.path(), ec))
+        continue;
+      total += size;
+      continue;
+    }
+
+    auto [it, inserted] = tracks.try_emplace(name.substr(0, 16));
+    track& t = it->second;
+    if (inserted || time > t.time) t.time = time;
+    t.files.push_back({e.path(), size});
+    total += size;
+  }
+  if (total <= maxBytes) return;
+
+  std::vector<const track*> order;
+  for (auto& [hash, t] : tracks) order.push_back(&t);
+  std::sort(order.begin(), order.end(),
+            [](const track* a, const track* b) { return a->time < b->time; });
+  for (const track* t : order) {
+    if (total <= maxBytes) break;
+    for (auto& [path, size] : t->files)
+      if (std::filesystem::remove(path, ec)) total -= size;
+  }
+}
+
+/**
+ * 开始写入一个缓存文件，样本先写到临时文件中
+ *
+ * return
+ * false 创建文件失败
+ */
+bool inline bgm_cache_begin(bgm_cache_writer* w, const std::string& dir,
+                            const std::string& key, ma_format format,
+                            ma_uint32 channels, ma_uint32 sampleRate) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+
+  w->path = bgm_cache_path(dir, key);
+  // 多个进程可能同时写同一个缓存
+  w->temp = w->path + "." +
+            std::to_string(
+                std::chrono::steady_clock::now().time_since_epoch().count()) +
+            ".tmp";
+  if ((w->file = fopen(w->temp.c_str(), "wb")) == nullptr) return false;
+
+  memset(&w->header, 0, sizeof(w->header));
+  memcpy(w->header.magic, BGM_CACHE_MAGIC, 8);
+  w->header.format = format;
+  w->header.channels = channels;
+  w->header.sampleRate = sampleRate;
+  w->header.keySize = (ma_uint32)key.size();
+
+  static const char zeros[16] = {0};
+  size_t padding = bgm_cache_pcm_offset(key.size()) -
+                   sizeof(bgm_cache_header) - key.size();
+  if (fwrite(&w->header, sizeof(w->header), 1, w->file) != 1 ||
+      fwrite(key.data(), 1, key.size(), w->file) != key.size() ||
+      fwrite(zeros, 1, padding, w->file) != padding) {
+    fclose(w->file);
+    w->file = nullptr;
+    std::filesystem::remove(w->temp, ec);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * 放弃写入，删除临时文件
+ */
+void inline bgm_cache_abort(bgm_cache_writer* w) {
+  if (w->file == nullptr) return;
+  fclose(w->file);
+  w->file = nullptr;
+
+  std::error_code ec;
+  std::filesystem::remove(w->temp, ec);
+}
+
+/**
+ * 追加交错样本，失败时放弃整个缓存文件
+ */
+void inline bgm_cache_write(bgm_cache_writer* w, const void* pcm,
+                            ma_uint64 frames) {
+  if (w->file == nullptr || frames == 0) return;
+
+  size_t bytes =
+      (size_t)(frames * ma_get_bytes_per_frame((ma_format)w->header.format,
+                                               w->header.channels));
+  if (fwrite(pcm, 1, bytes, w->file) != bytes) {
+    bgm_cache_abort(w);
+    return;
+  }
+  w->header.frames += frames;
+}
+
+/**
+ * 补上帧数后把临时文件改名为缓存文件，然后检查缓存目录的大小
+ */
+void inline bgm_cache_finish(bgm_cache_writer* w, ma_uint64 maxBytes) {
+  if (w->file == nullptr) return;
+
+  bool ok = fseek(w->file, 0, SEEK_SET) == 0 &&
+            fwrite(&w->header, sizeof(w->header), 1, w->file) == 1;
+  ok = fclose(w->file) == 0 && ok;
+  w->file = nullptr;
+
+  std::error_code ec;
+  if (ok) std::filesystem::rename(w->temp, w->path, ec);
+  if (!ok || ec) {
+    std::filesystem::remove(w->temp, ec);
+    return;
+  }
+
+  bgm_cache_evict(std::filesystem::path(w->path).parent_path().string(),
+                  maxBytes);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+进程内共享的 ma_context。
+
+ma_device_init 的 context 参数为 NULL 时，每个设备都会创建并销毁一个自己的
+ma_context：探测后端、加载动态库、连接音频服务。所有 Bgm/BgmMixer 的设备共用
+一个引用计数的 ma_context，第一个设备创建时初始化，最后一个设备释放后销毁
+*/
+
+#include <mutex>
+
+#include "miniaudio.h"
+
+typedef struct {
+  std::mutex mutex;
+  ma_context context;
+  ma_uint32 refs; /*引用计数，0 表示 context 没有初始化*/
+} bgm_shared_context;
+
+bgm_shared_context inline& _bgm_shared_context() {
+  static bgm_shared_context shared{};
+  return shared;
+}
+
+/**
+ * 获取共享的 ma_context，第一次调用时初始化。每次成功的调用都要对应一次
+ * bgm_context_release，设备必须在 release 之前 uninit
+ *
+ * return
+ * nullptr 初始化失败
+ */
+ma_context inline* bgm_context_acquire() {
+  bgm_shared_context& shared = _bgm_shared_context();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+
+  if (shared.refs == 0 &&
+      ma_context_init(NULL, 0, NULL, &shared.context) != MA_SUCCESS)
+    return nullptr;
+
+  shared.refs++;
+  return &shared.context;
+}
+
+/**
+ * 释放 bgm_context_acquire 得到的引用，最后一个引用释放时销毁 ma_context
+ */
+void inline bgm_context_release() {
+  bgm_shared_context& shared = _bgm_shared_context();
+  std::lock_guard<std::mutex> lock(shared.mutex);
+
+  if (shared.refs == 0) return;
+  if (--shared.refs == 0) ma_context_uninit(&shared.context);
+}
@@ -0,0 +1,509 @@
+#pragma once
+
+/*
+平面格式到交错格式的转换内核，代替最常见情况下的 swresample。
+
+每个转换都有一个标量版本作为参考实现，另外在 x86-64 上有 SSE2/AVX2 版本，
+在 ARM64 上有 NEON 版本，运行时按 CPU 支持的指令集选择。
+SIMD 版本只处理双声道，其他声道数以及尾部不足一个向量的帧使用标量版本，
+结果和标量版本逐位相同
+*/
+
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+
+#include "miniaudio.h"
+
+extern "C" {
+#include "libavutil/samplefmt.h"
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BGM_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BGM_ARM64
+#include <arm_neon.h>
+#endif
+
+#if defined(BGM_X64) && (defined(__GNUC__) || defined(__clang__))
+#define BGM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BGM_TARGET_AVX2
+#endif
+
+typedef enum : int {
+  bgm_simd_scalar = 0,
+  bgm_simd_sse2,
+  bgm_simd_avx2,
+  bgm_simd_neon,
+  bgm_simd_best, /*运行时检测到的最好的指令集*/
+} bgm_simd;
+
+static std::string_view bgm_simd_strings[] = {
+    "scalar", "sse2", "avx2", "neon", "best",
+};
+
+/**
+ * 转换内核
+ *
+ * params
+ * dst 交错格式的输出
+ * src 每个声道一个平面
+ * offset 从每个平面的第 offset 帧开始读取
+ * frames 转换的帧数
+ * channels 声道数
+ */
+typedef void (*bgm_convert_proc)(void* dst, const uint8_t* const* src,
+                                 ma_uint32 offset, ma_uint32 frames,
+                                 ma_uint32 channels);
+
+/**
+ * 检测当前 CPU 支持的最好的指令集
+ */
+bgm_simd inline bgm_simd_detect() {
+#if defined(BGM_X64)
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuidex(info, 7, 0);
+  bool avx2 = (info[1] & (1 << 5)) != 0;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (avx2 && osxsave && (_xgetbv(0) & 6) == 6) return bgm_simd_avx2;
+#else
+  if (__builtin_cpu_supports("avx2")) return bgm_simd_avx2;
+#endif
+  return bgm_simd_sse2;  // x86-64 一定支持 SSE2
+#elif defined(BGM_ARM64)
+  return bgm_simd_neon;  // ARM64 一定支持 NEON
+#else
+  return bgm_simd_scalar;
+#endif
+}
+
+/*
+标量参考实现
+
+fltp -> s16 先把 x * 32768 限制在 [-32768, 32767]，再按当前舍入模式
+（就近取偶）取整，对所有有限值和 swresample 的
+av_clip_int16(lrintf(x * 32768)) 结果相同；
+s32p -> s16 和 swresample 一样取高 16 位
+*/
+
+inline void bgm_convert_fltp_s16_scalar(void* dst, const uint8_t* const* src,
+                                        ma_uint32 offset, ma_uint32 frames,
+                                        ma_uint32 channels) {
+  ma_int16* out = (ma_int16*)dst;
+  for (ma_uint32 c = 0; c < channels; c++) {
+    const float* in = (const float*)src[c] + offset;
+    for (ma_uint32 i = 0; i < frames; i++) {
+      float x = in[i] * 32768.0f;
+      x = x < -32768.0f ? -32768.0f : (x > 32767.0f ? 32767.0f : x);
+      out[i * channels + c] = (ma_int16)lrintf(x);
+    }
+  }
+}
+
+inline void bgm_convert_fltp_f32_scalar(void* dst, const uint8_t* const* src,
+                                        ma_uint32 offset, ma_uint32 frames,
+                                        ma_uint32 channels) {
+  float* out = (float*)dst;
+  for (ma_uint32 c = 0; c < channels; c++) {
+    const float* in = (const float*)src[c] + offset;
+    for (ma_uint32 i = 0; i < frames; i++) out[i * channels + c] = in[i];
+  }
+}
+
+inline void bgm_convert_s16p_s16_scalar(void* dst, const uint8_t* const* src,
+                                        ma_uint32 offset, ma_uint32 frames,
+                                        ma_uint32 channels) {
+  ma_int16* out = (ma_int16*)dst;
+  for (ma_uint32 c = 0; c < channels; c++) {
+    const ma_int16* in = (const ma_int16*)src[c] + offset;
+    for (ma_uint32 i = 0; i < frames; i++) out[i * channels + c] = in[i];
+  }
+}
+
+inline void bgm_convert_s32p_s16_scalar(void* dst, const uint8_t* const* src,
+                                        ma_uint32 offset, ma_uint32 frames,
+                                        ma_uint32 channels) {
+  ma_int16* out = (ma_int16*)dst;
+  for (ma_uint32 c = 0; c < channels; c++) {
+    const ma_int32* in = (const ma_int32*)src[c] + offset;
+    for (ma_uint32 i = 0; i < frames; i++)
+      out[i * channels + c] = (ma_int16)(in[i] >> 16);
+  }
+}
+
+/*
+SIMD 版本的尾部处理：把剩余的帧交给标量版本，src 偏移 done 帧，dst 偏移 done 帧
+*/
+#define BGM_CONVERT_TAIL(scalar, type)                                     \
+  if (done < frames)                                                       \
+    scalar((type*)dst + (size_t)done * 2, src, offset + done, frames - done, \
+           2)
+
+#if defined(BGM_X64)
+
+inline void bgm_convert_fltp_s16_sse2(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_fltp_s16_scalar(dst, src, offset, frames, channels);
+
+  const float* l = (const float*)src[0] + offset;
+  const float* r = (const float*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    __m128 fl = _mm_mul_ps(_mm_loadu_ps(l + done), scale);
+    __m128 fr = _mm_mul_ps(_mm_loadu_ps(r + done), scale);
+    __m128i il = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(fl, lo), hi));
+    __m128i ir = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(fr, lo), hi));
+    __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(il, ir),
+                                     _mm_unpackhi_epi32(il, ir));
+    _mm_storeu_si128((__m128i*)(out + done * 2), packed);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_fltp_s16_scalar, ma_int16);
+}
+
+inline void bgm_convert_fltp_f32_sse2(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_fltp_f32_scalar(dst, src, offset, frames, channels);
+
+  const float* l = (const float*)src[0] + offset;
+  const float* r = (const float*)src[1] + offset;
+  float* out = (float*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    __m128 fl = _mm_loadu_ps(l + done);
+    __m128 fr = _mm_loadu_ps(r + done);
+    _mm_storeu_ps(out + done * 2, _mm_unpacklo_ps(fl, fr));
+    _mm_storeu_ps(out + done * 2 + 4, _mm_unpackhi_ps(fl, fr));
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_fltp_f32_scalar, float);
+}
+
+inline void bgm_convert_s16p_s16_sse2(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_s16p_s16_scalar(dst, src, offset, frames, channels);
+
+  const ma_int16* l = (const ma_int16*)src[0] + offset;
+  const ma_int16* r = (const ma_int16*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 8 <= frames; done += 8) {
+    __m128i il = _mm_loadu_si128((const __m128i*)(l + done));
+    __m128i ir = _mm_loadu_si128((const __m128i*)(r + done));
+    _mm_storeu_si128((__m128i*)(out + done * 2), _mm_unpacklo_epi16(il, ir));
+    _mm_storeu_si128((__m128i*)(out + done * 2 + 8),
+                     _mm_unpackhi_epi16(il, ir));
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_s16p_s16_scalar, ma_int16);
+}
+
+inline void bgm_convert_s32p_s16_sse2(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_s32p_s16_scalar(dst, src, offset, frames, channels);
+
+  const ma_int32* l = (const ma_int32*)src[0] + offset;
+  const ma_int32* r = (const ma_int32*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    __m128i il =
+        _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(l + done)), 16);
+    __m128i ir =
+        _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(r + done)), 16);
+    __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(il, ir),
+                                     _mm_unpackhi_epi32(il, ir));
+    _mm_storeu_si128((__m128i*)(out + done * 2), packed);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_s32p_s16_scalar, ma_int16);
+}
+
+/*
+AVX2 的 unpack 和 pack 都在 128 位的两半内分别进行：
+unpack + pack 的组合恰好保持顺序，单独 unpack 需要再用 permute2x128 交换两半
+*/
+
+BGM_TARGET_AVX2 inline void bgm_convert_fltp_s16_avx2(
+    void* dst, const uint8_t* const* src, ma_uint32 offset, ma_uint32 frames,
+    ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_fltp_s16_scalar(dst, src, offset, frames, channels);
+
+  const float* l = (const float*)src[0] + offset;
+  const float* r = (const float*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+  const __m256 scale = _mm256_set1_ps(32768.0f);
+  const __m256 lo = _mm256_set1_ps(-32768.0f);
+  const __m256 hi = _mm256_set1_ps(32767.0f);
+
+  ma_uint32 done = 0;
+  for (; done + 8 <= frames; done += 8) {
+    __m256 fl = _mm256_mul_ps(_mm256_loadu_ps(l + done), scale);
+    __m256 fr = _mm256_mul_ps(_mm256_loadu_ps(r + done), scale);
+    __m256i il = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(fl, lo), hi));
+    __m256i ir = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(fr, lo), hi));
+    __m256i packed = _mm256_packs_epi32(_mm256_unpacklo_epi32(il, ir),
+                                        _mm256_unpackhi_epi32(il, ir));
+    _mm256_storeu_si256((__m256i*)(out + done * 2), packed);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_fltp_s16_scalar, ma_int16);
+}
+
+BGM_TARGET_AVX2 inline void bgm_convert_fltp_f32_avx2(
+    void* dst, const uint8_t* const* src, ma_uint32 offset, ma_uint32 frames,
+    ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_fltp_f32_scalar(dst, src, offset, frames, channels);
+
+  const float* l = (const float*)src[0] + offset;
+  const float* r = (const float*)src[1] + offset;
+  float* out = (float*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 8 <= frames; done += 8) {
+    __m256 fl = _mm256_loadu_ps(l + done);
+    __m256 fr = _mm256_loadu_ps(r + done);
+    __m256 a = _mm256_unpacklo_ps(fl, fr);
+    __m256 b = _mm256_unpackhi_ps(fl, fr);
+    _mm256_storeu_ps(out + done * 2, _mm256_permute2f128_ps(a, b, 0x20));
+    _mm256_storeu_ps(out + done * 2 + 8, _mm256_permute2f128_ps(a, b, 0x31));
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_fltp_f32_scalar, float);
+}
+
+BGM_TARGET_AVX2 inline void bgm_convert_s16p_s16_avx2(
+    void* dst, const uint8_t* const* src, ma_uint32 offset, ma_uint32 frames,
+    ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_s16p_s16_scalar(dst, src, offset, frames, channels);
+
+  const ma_int16* l = (const ma_int16*)src[0] + offset;
+  const ma_int16* r = (const ma_int16*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 16 <= frames; done += 16) {
+    __m256i il = _mm256_loadu_si256((const __m256i*)(l + done));
+    __m256i ir = _mm256_loadu_si256((const __m256i*)(r + done));
+    __m256i a = _mm256_unpacklo_epi16(il, ir);
+    __m256i b = _mm256_unpackhi_epi16(il, ir);
+    _mm256_storeu_si256((__m256i*)(out + done * 2),
+                        _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + done * 2 + 16),
+                        _mm256_permute2x128_si256(a, b, 0x31));
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_s16p_s16_scalar, ma_int16);
+}
+
+BGM_TARGET_AVX2 inline void bgm_convert_s32p_s16_avx2(
+    void* dst, const uint8_t* const* src, ma_uint32 offset, ma_uint32 frames,
+    ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_s32p_s16_scalar(dst, src, offset, frames, channels);
+
+  const ma_int32* l = (const ma_int32*)src[0] + offset;
+  const ma_int32* r = (const ma_int32*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 8 <= frames; done += 8) {
+    __m256i il =
+        _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(l + done)), 16);
+    __m256i ir =
+        _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(r + done)), 16);
+    __m256i packed = _mm256_packs_epi32(_mm256_unpacklo_epi32(il, ir),
+                                        _mm256_unpackhi_epi32(il, ir));
+    _mm256_storeu_si256((__m256i*)(out + done * 2), packed);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_s32p_s16_scalar, ma_int16);
+}
+
+#endif
+
+#if defined(BGM_ARM64)
+
+inline void bgm_convert_fltp_s16_neon(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_fltp_s16_scalar(dst, src, offset, frames, channels);
+
+  const float* l = (const float*)src[0] + offset;
+  const float* r = (const float*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+  const float32x4_t lo = vdupq_n_f32(-32768.0f);
+  const float32x4_t hi = vdupq_n_f32(32767.0f);
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    float32x4_t fl = vmulq_n_f32(vld1q_f32(l + done), 32768.0f);
+    float32x4_t fr = vmulq_n_f32(vld1q_f32(r + done), 32768.0f);
+    int16x4x2_t lr;
+    lr.val[0] = vqmovn_s32(vcvtnq_s32_f32(vminq_f32(vmaxq_f32(fl, lo), hi)));
+    lr.val[1] = vqmovn_s32(vcvtnq_s32_f32(vminq_f32(vmaxq_f32(fr, lo), hi)));
+    vst2_s16(out + done * 2, lr);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_fltp_s16_scalar, ma_int16);
+}
+
+inline void bgm_convert_fltp_f32_neon(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_fltp_f32_scalar(dst, src, offset, frames, channels);
+
+  const float* l = (const float*)src[0] + offset;
+  const float* r = (const float*)src[1] + offset;
+  float* out = (float*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    float32x4x2_t lr;
+    lr.val[0] = vld1q_f32(l + done);
+    lr.val[1] = vld1q_f32(r + done);
+    vst2q_f32(out + done * 2, lr);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_fltp_f32_scalar, float);
+}
+
+inline void bgm_convert_s16p_s16_neon(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_s16p_s16_scalar(dst, src, offset, frames, channels);
+
+  const ma_int16* l = (const ma_int16*)src[0] + offset;
+  const ma_int16* r = (const ma_int16*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 8 <= frames; done += 8) {
+    int16x8x2_t lr;
+    lr.val[0] = vld1q_s16(l + done);
+    lr.val[1] = vld1q_s16(r + done);
+    vst2q_s16(out + done * 2, lr);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_s16p_s16_scalar, ma_int16);
+}
+
+inline void bgm_convert_s32p_s16_neon(void* dst, const uint8_t* const* src,
+                                      ma_uint32 offset, ma_uint32 frames,
+                                      ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_convert_s32p_s16_scalar(dst, src, offset, frames, channels);
+
+  const ma_int32* l = (const ma_int32*)src[0] + offset;
+  const ma_int32* r = (const ma_int32*)src[1] + offset;
+  ma_int16* out = (ma_int16*)dst;
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    int16x4x2_t lr;
+    lr.val[0] = vshrn_n_s32(vld1q_s32(l + done), 16);
+    lr.val[1] = vshrn_n_s32(vld1q_s32(r + done), 16);
+    vst2_s16(out + done * 2, lr);
+  }
+
+  BGM_CONVERT_TAIL(bgm_convert_s32p_s16_scalar, ma_int16);
+}
+
+#endif
+
+#undef BGM_CONVERT_TAIL
+
+/**
+ * 查找 in -> out 的转换内核
+ *
+ * params
+ * simd 指定指令集，bgm_simd_best 表示运行时检测
+ *
+ * return
+ * nullptr 没有对应的内核，或者当前平台不支持指定的指令集
+ */
+bgm_convert_proc inline bgm_convert_find(AVSampleFormat in, AVSampleFormat out,
+                                         bgm_simd simd = bgm_simd_best) {
+  static const struct {
+    AVSampleFormat in;
+    AVSampleFormat out;
+    bgm_convert_proc procs[4]; /*按 bgm_simd 排列*/
+  } kernels[] = {
+#if defined(BGM_X64)
+      {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16,
+       {bgm_convert_fltp_s16_scalar, bgm_convert_fltp_s16_sse2,
+        bgm_convert_fltp_s16_avx2, nullptr}},
+      {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT,
+       {bgm_convert_fltp_f32_scalar, bgm_convert_fltp_f32_sse2,
+        bgm_convert_fltp_f32_avx2, nullptr}},
+      {AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16,
+       {bgm_convert_s16p_s16_scalar, bgm_convert_s16p_s16_sse2,
+        bgm_convert_s16p_s16_avx2, nullptr}},
+      {AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_S16,
+       {bgm_convert_s32p_s16_scalar, bgm_convert_s32p_s16_sse2,
+        bgm_convert_s32p_s16_avx2, nullptr}},
+#elif defined(BGM_ARM64)
+      {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16,
+       {bgm_convert_fltp_s16_scalar, nullptr, nullptr,
+        bgm_convert_fltp_s16_neon}},
+      {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT,
+       {bgm_convert_fltp_f32_scalar, nullptr, nullptr,
+        bgm_convert_fltp_f32_neon}},
+      {AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16,
+       {bgm_convert_s16p_s16_scalar, nullptr, nullptr,
+        bgm_convert_s16p_s16_neon}},
+      {AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_S16,
+       {bgm_convert_s32p_s16_scalar, nullptr, nullptr,
+        bgm_convert_s32p_s16_neon}},
+#else
+      {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16,
+       {bgm_convert_fltp_s16_scalar, nullptr, nullptr, nullptr}},
+      {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT,
+       {bgm_convert_fltp_f32_scalar, nullptr, nullptr, nullptr}},
+      {AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16,
+       {bgm_convert_s16p_s16_scalar, nullptr, nullptr, nullptr}},
+      {AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_S16,
+       {bgm_convert_s32p_s16_scalar, nullptr, nullptr, nullptr}},
+#endif
+  };
+
+  static const bgm_simd best = bgm_simd_detect();
+  if (simd == bgm_simd_best) simd = best;
+  if (simd > best) return nullptr;
+
+  for (auto& kernel : kernels) {
+    if (kernel.in == in && kernel.out == out) return kernel.procs[simd];
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+/*
+自定义的 AVIOContext 输入层。
+
+bgm_mmap_io：本地文件映射到内存后通过读写回调交给 ffmpeg，读取只是一次
+memcpy，解码过程中没有 read() 系统调用，多个播放器打开同一个文件时共享页缓存。
+读取位置前方用 MADV_WILLNEED 提示内核预读，seek 之后从新的位置重新开始提示
+
+BgmReadaheadIo：给 NFS、机械硬盘、网络地址用的预读层。后台 IO 线程用 ffmpeg
+自己的 AVIOContext 读取，始终在解复用的读取位置前方保持一个窗口的数据，
+解复用线程大部分时候直接从内存读取
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bgm_mmap.h"
+#include "bgm_time.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#define BGM_IO_BUFFER_SIZE (256 * 1024)       /*AVIOContext 的缓冲区*/
+#define BGM_IO_WILLNEED_SIZE (4 * 1024 * 1024) /*读取位置前方提示预读的长度*/
+
+typedef struct {
+  bgm_mmap map;
+  int64_t pos;      /*下一次读取的位置*/
+  int64_t willneed; /*已经提示过预读的位置*/
+  AVIOContext* pb;  /*nullptr 表示没有打开*/
+} bgm_mmap_io;
+
+int inline bgm_mmap_io_read(void* opaque, uint8_t* buf, int size) {
+  bgm_mmap_io* io = (bgm_mmap_io*)opaque;
+  int64_t left = (int64_t)io->map.size - io->pos;
+  if (left <= 0) return AVERROR_EOF;
+
+  // 预读的窗口用掉一半时再往前提示一个窗口
+  if (io->pos + BGM_IO_WILLNEED_SIZE / 2 >= io->willneed) {
+    bgm_mmap_willneed(&io->map, (size_t)io->pos, BGM_IO_WILLNEED_SIZE);
+    io->willneed = io->pos + BGM_IO_WILLNEED_SIZE;
+  }
+
+  int n = (int)std::min<int64_t>(size, left);
+  memcpy(buf, io->map.data + io->pos, n);
+  io->pos += n;
+  return n;
+}
+
+int64_t inline bgm_mmap_io_seek(void* opaque, int64_t offset, int whence) {
+  bgm_mmap_io* io = (bgm_mmap_io*)opaque;
+  int64_t pos;
+
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return (int64_t)io->map.size;
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = io->pos + offset;
+      break;
+    case SEEK_END:
+      pos = (int64_t)io->map.size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0) return AVERROR(EINVAL);
+
+  io->pos = pos;
+  io->willneed = pos;
+  return pos;
+}
+
+/**
+ * 映射本地文件并创建对应的 AVIOContext，赋值给 AVFormatContext.pb 使用
+ *
+ * return
+ * false 不是能映射的本地文件，或者分配失败
+ */
+bool inline bgm_mmap_io_open(bgm_mmap_io* io, const char* path) {
+  io->pb = nullptr;
+  if (!bgm_mmap_open(&io->map, path)) return false;
+  bgm_mmap_advise_sequential(&io->map);
+  io->pos = 0;
+  io->willneed = 0;
+
+  uint8_t* buffer = (uint8_t*)av_malloc(BGM_IO_BUFFER_SIZE);
+  if (buffer != nullptr)
+    io->pb = avio_alloc_context(buffer, BGM_IO_BUFFER_SIZE, 0, io,
+                                bgm_mmap_io_read, NULL, bgm_mmap_io_seek);
+  if (io->pb == nullptr) {
+    av_free(buffer);
+    bgm_mmap_close(&io->map);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * 释放 AVIOContext 并解除映射，需要在 avformat_close_input 之后调用
+ */
+void inline bgm_mmap_io_close(bgm_mmap_io* io) {
+  if (io->pb == nullptr) return;
+  av_freep(&io->pb->buffer);
+  avio_context_free(&io->pb);
+  bgm_mmap_close(&io->map);
+}
+
+typedef struct {
+  ma_uint64 hits;     /*不需要等待 IO 线程的读取次数*/
+  ma_uint64 misses;   /*需要等待 IO 线程的读取次数*/
+  ma_uint64 seeks;    /*落在窗口之外、需要 IO 线程重新定位的 seek 次数*/
+  int64_t stallTime;  /*等待 IO 线程的总时间，单位纳秒*/
+} bgm_io_stats;
+
+class BgmReadaheadIo {
+ private:
+  AVIOContext* inner{nullptr};  // IO 线程使用的 ffmpeg 自己的 IO
+  int64_t size = -1;            // 文件大小，未知时小于 0
+
+  // 环形窗口，文件位置 o 的数据存放在 window[o % window.size()]。
+  // 窗口里是 [start, end)，解复用的读取位置 pos 在其中；pos 之前的数据保留到
+  // 被新数据覆盖为止，往回的小范围 seek 不需要重新读取
+  std::vector<uint8_t> window;
+  int64_t start = 0;
+  int64_t end = 0;
+  int64_t pos = 0;
+  bool eof = false;
+  int error = 0;
+
+  // seek 到窗口之外时 generation 加一，IO 线程丢弃正在读取的旧数据
+  ma_uint64 generation = 0;
+  int64_t seekTarget = -1;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread thread;
+  bool stop = false;
+
+  std::atomic<ma_uint64> hits{0};
+  std::atomic<ma_uint64> misses{0};
+  std::atomic<ma_uint64> seeks{0};
+  std::atomic<int64_t> stallTime{0};
+
+ private:
+  /**
+   * IO 线程：窗口没有满时从 inner 读取到窗口中
+   */
+  void _run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stop) {
+      if (seekTarget >= 0) {
+        int64_t target = seekTarget;
+        seekTarget = -1;
+        lock.unlock();
+        int64_t ret = avio_seek(inner, target, SEEK_SET);
+        lock.lock();
+        if (ret < 0 && seekTarget < 0) error = (int)ret;
+        continue;
+      }
+
+      int64_t capacity = (int64_t)window.size();
+      if (eof || error != 0 || end - pos >= capacity) {
+        cond.wait(lock);
+        continue;
+      }
+
+      // 一次最多读 256KB，并且不跨过环形窗口的末尾
+      int64_t offset = end % capacity;
+      int chunk = (int)std::min<int64_t>(
+          {capacity - (end - pos), capacity - offset, 256 * 1024});
+      // 先让出要写入的位置，解复用线程不会再读取这部分旧数据
+      start = std::max(start, end + chunk - capacity);
+      ma_uint64 current = generation;
+
+      lock.unlock();
+      int n = avio_read(inner, window.data() + offset, chunk);
+      lock.lock();
+
+      if (current != generation) continue;
+      if (n > 0) {
+        end += n;
+      } else if (n == AVERROR_EOF || n == 0) {
+        eof = true;
+      } else {
+        error = n;
+      }
+      cond.notify_all();
+    }
+  }
+
+  static int _read(void* opaque, uint8_t* buf, int bufSize) {
+    BgmReadaheadIo* io = (BgmReadaheadIo*)opaque;
+    std::unique_lock<std::mutex> lock(io->mutex);
+
+    if (io->end > io->pos) {
+      io->hits++;
+    } else {
+      io->misses++;
+      int64_t begin = bgm_now_ns();
+      io->cond.wait(lock, [io] {
+        return io->end > io->pos || io->eof || io->error != 0 || io->stop;
+      });
+      io->stallTime += bgm_now_ns() - begin;
+    }
+
+    if (io->end <= io->pos) return io->error != 0 ? io->error : AVERROR_EOF;
+
+    int64_t capacity = (int64_t)io->window.size();
+    int n = (int)std::min<int64_t>(bufSize, io->end - io->pos);
+    int64_t offset = io->pos % capacity;
+    int first = (int)std::min<int64_t>(n, capacity - offset);
+    memcpy(buf, io->window.data() + offset, first);
+    memcpy(buf + first, io->window.data(), n - first);
+    io->pos += n;
+
+    io->cond.notify_all();
+    return n;
+  }
+
+  static int64_t _seek(void* opaque, int64_t offset, int whence) {
+    BgmReadaheadIo* io = (BgmReadaheadIo*)opaque;
+    std::unique_lock<std::mutex> lock(io->mutex);
+    int64_t target;
+
+    switch (whence & ~AVSEEK_FORCE) {
+      case AVSEEK_SIZE:
+        return io->size;
+      case SEEK_SET:
+        target = offset;
+        break;
+      case SEEK_CUR:
+        target = io->pos + offset;
+        break;
+      case SEEK_END:
+        if (io->size < 0) return AVERROR(EINVAL);
+        target = io->size + offset;
+        break;
+      default:
+        return AVERROR(EINVAL);
+    }
+    if (target < 0) return AVERROR(EINVAL);
+
+    // 窗口里已经有的数据只需要移动读取位置
+    if (target >= io->start && target <= io->end) {
+      io->pos = target;
+      return target;
+    }
+
+    io->seeks++;
+    io->generation++;
+    io->seekTarget = target;
+    io->start = io->end = io->pos = target;
+    io->eof = false;
+    io->error = 0;
+    io->cond.notify_all();
+    return target;
+  }
+
+ public:
+  AVIOContext* pb{nullptr};  // 赋值给 AVFormatContext.pb 使用
+
+ public:
+  ~BgmReadaheadIo() { close(); }
+
+  /**
+   * 打开 url 并启动 IO 线程
+   *
+   * params
+   * windowSize 预读窗口的字节数
+   *
+   * return
+   * false 打开失败
+   */
+  bool open(const char* url, size_t windowSize) {
+    if (avio_open2(&inner, url, AVIO_FLAG_READ, NULL, NULL) < 0) return false;
+    size = avio_size(inner);
+
+    window.assign(std::max<size_t>(windowSize, 256 * 1024), 0);
+    start = end = pos = 0;
+    eof = stop = false;
+    error = 0;
+
+    uint8_t* buffer = (uint8_t*)av_malloc(BGM_IO_BUFFER_SIZE);
+    if (buffer != nullptr)
+      pb = avio_alloc_context(buffer, BGM_IO_BUFFER_SIZE, 0, this, _read, NULL,
+                              _seek);
+    if (pb == nullptr) {
+      av_free(buffer);
+      avio_closep(&inner);
+      return false;
+    }
+    pb->seekable = inner->seekable;
+
+    try {
+      thread = std::thread([this] { _run(); });
+    } catch (const std::system_error&) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * 停止 IO 线程并释放所有资源，需要在 avformat_close_input 之后调用
+   */
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    cond.notify_all();
+    if (thread.joinable()) thread.join();
+
+    if (pb != nullptr) av_freep(&pb->buffer);
+    avio_context_free(&pb);
+    avio_closep(&inner);
+    std::vector<uint8_t>().swap(window);
+  }
+
+  /**
+   * 读取统计，可以在其他线程调用
+   */
+  bgm_io_stats get_stats() const {
+    bgm_io_stats stats;
+    stats.hits = hits.load();
+    stats.misses = misses.load();
+    stats.seeks = seeks.load();
+    stats.stallTime = stallTime.load();
+    return stats;
+  }
+};
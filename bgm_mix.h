@@ -0,0 +1,656 @@
+#pragma once
+
+/*
+交错样本的混音内核。
+
+crossfade：两路音频按等功率曲线交叉淡入淡出，淡出增益 cos(θ)、淡入增益
+sin(θ)，θ 从 0 线性增加到 π/2，两路不相关时总功率保持不变。
+和 bgm_convert.h 一样每个内核都有标量参考实现，SIMD 版本只处理双声道。
+
+accumulate/store：多路音频乘以各自的增益后累加到 f32 累加缓冲区，
+全部累加完再一次性饱和到输出格式，结果和累加顺序无关。
+s16 累加时保持 s16 的幅度，f32 输出限制在 [-1, 1]。
+这两个内核逐样本处理，和声道数无关。
+
+SIMD 版本的乘法和加法是分开的两步，标量版本必须用 -ffp-contract=off 编译
+（见 CMakeLists.txt），否则在有 FMA 的平台上会被合并成一次舍入，和 SIMD
+版本的最后一位不同
+*/
+
+#include <cmath>
+#include <cstdint>
+
+#include "bgm_convert.h"
+#include "miniaudio.h"
+
+/**
+ * 交叉淡化内核
+ *
+ * params
+ * dst 输出，可以和 a 或 b 相同
+ * a 淡出的音轨
+ * b 淡入的音轨
+ * gainA gainB 每一帧的增益，由 bgm_fade_gains 计算
+ * frames 帧数
+ * channels 声道数
+ */
+typedef void (*bgm_crossfade_proc)(void* dst, const void* a, const void* b,
+                                   const float* gainA, const float* gainB,
+                                   ma_uint32 frames, ma_uint32 channels);
+
+/**
+ * 计算淡化第 [position, position + frames) 帧的等功率增益
+ *
+ * 每次调用用 cos/sin 求出起点的精确值，之后每帧乘一个固定的旋转，
+ * 不需要每帧计算三角函数
+ *
+ * params
+ * length 淡化的总帧数
+ */
+inline void bgm_fade_gains(float* gainA, float* gainB, ma_uint64 position,
+                           ma_uint64 length, ma_uint32 frames) {
+  const double quarter = 1.5707963267948966;
+  double step = quarter / (double)length;
+  double c = std::cos(step * (double)position);
+  double s = std::sin(step * (double)position);
+  double cd = std::cos(step), sd = std::sin(step);
+
+  for (ma_uint32 i = 0; i < frames; i++) {
+    gainA[i] = (float)c;
+    gainB[i] = (float)s;
+    double next = c * cd - s * sd;
+    s = s * cd + c * sd;
+    c = next;
+  }
+}
+
+/*
+标量参考实现。s16 和 bgm_convert.h 一样先限制范围再就近取偶
+*/
+
+inline void bgm_crossfade_f32_scalar(void* dst, const void* a, const void* b,
+                                     const float* gainA, const float* gainB,
+                                     ma_uint32 frames, ma_uint32 channels) {
+  float* out = (float*)dst;
+  const float* x = (const float*)a;
+  const float* y = (const float*)b;
+  for (ma_uint32 i = 0; i < frames; i++) {
+    for (ma_uint32 c = 0; c < channels; c++) {
+      size_t k = (size_t)i * channels + c;
+      float u = x[k] * gainA[i];
+      float v = y[k] * gainB[i];
+      out[k] = u + v;
+    }
+  }
+}
+
+inline void bgm_crossfade_s16_scalar(void* dst, const void* a, const void* b,
+                                     const float* gainA, const float* gainB,
+                                     ma_uint32 frames, ma_uint32 channels) {
+  ma_int16* out = (ma_int16*)dst;
+  const ma_int16* x = (const ma_int16*)a;
+  const ma_int16* y = (const ma_int16*)b;
+  for (ma_uint32 i = 0; i < frames; i++) {
+    for (ma_uint32 c = 0; c < channels; c++) {
+      size_t k = (size_t)i * channels + c;
+      float u = (float)x[k] * gainA[i];
+      float v = (float)y[k] * gainB[i];
+      float m = u + v;
+      m = m < -32768.0f ? -32768.0f : (m > 32767.0f ? 32767.0f : m);
+      out[k] = (ma_int16)lrintf(m);
+    }
+  }
+}
+
+/*
+SIMD 版本的尾部处理：剩余的帧交给标量版本
+*/
+#define BGM_CROSSFADE_TAIL(scalar, type)                                  \
+  if (done < frames)                                                      \
+    scalar((type*)dst + (size_t)done * 2, (const type*)a + (size_t)done * 2, \
+           (const type*)b + (size_t)done * 2, gainA + done, gainB + done,  \
+           frames - done, 2)
+
+#if defined(BGM_X64)
+
+inline void bgm_crossfade_f32_sse2(void* dst, const void* a, const void* b,
+                                   const float* gainA, const float* gainB,
+                                   ma_uint32 frames, ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_crossfade_f32_scalar(dst, a, b, gainA, gainB, frames, channels);
+
+  float* out = (float*)dst;
+  const float* x = (const float*)a;
+  const float* y = (const float*)b;
+
+  ma_uint32 done = 0;
+  for (; done + 2 <= frames; done += 2) {
+    // 两帧的增益 g0 g1 展开成 g0 g0 g1 g1
+    __m128 ga = _mm_castpd_ps(_mm_load_sd((const double*)(gainA + done)));
+    __m128 gb = _mm_castpd_ps(_mm_load_sd((const double*)(gainB + done)));
+    ga = _mm_unpacklo_ps(ga, ga);
+    gb = _mm_unpacklo_ps(gb, gb);
+    __m128 u = _mm_mul_ps(_mm_loadu_ps(x + done * 2), ga);
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(y + done * 2), gb);
+    _mm_storeu_ps(out + done * 2, _mm_add_ps(u, v));
+  }
+
+  BGM_CROSSFADE_TAIL(bgm_crossfade_f32_scalar, float);
+}
+
+inline void bgm_crossfade_s16_sse2(void* dst, const void* a, const void* b,
+                                   const float* gainA, const float* gainB,
+                                   ma_uint32 frames, ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_crossfade_s16_scalar(dst, a, b, gainA, gainB, frames, channels);
+
+  ma_int16* out = (ma_int16*)dst;
+  const ma_int16* x = (const ma_int16*)a;
+  const ma_int16* y = (const ma_int16*)b;
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    __m128i ix = _mm_loadu_si128((const __m128i*)(x + done * 2));
+    __m128i iy = _mm_loadu_si128((const __m128i*)(y + done * 2));
+    // s16 符号扩展到 s32：先放到高 16 位再算术右移
+    __m128 x0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(ix, ix), 16));
+    __m128 x1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(ix, ix), 16));
+    __m128 y0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(iy, iy), 16));
+    __m128 y1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(iy, iy), 16));
+
+    __m128 ga = _mm_loadu_ps(gainA + done);
+    __m128 gb = _mm_loadu_ps(gainB + done);
+    __m128 ga0 = _mm_unpacklo_ps(ga, ga), ga1 = _mm_unpackhi_ps(ga, ga);
+    __m128 gb0 = _mm_unpacklo_ps(gb, gb), gb1 = _mm_unpackhi_ps(gb, gb);
+
+    __m128 m0 = _mm_add_ps(_mm_mul_ps(x0, ga0), _mm_mul_ps(y0, gb0));
+    __m128 m1 = _mm_add_ps(_mm_mul_ps(x1, ga1), _mm_mul_ps(y1, gb1));
+    __m128i i0 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(m0, lo), hi));
+    __m128i i1 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(m1, lo), hi));
+    _mm_storeu_si128((__m128i*)(out + done * 2), _mm_packs_epi32(i0, i1));
+  }
+
+  BGM_CROSSFADE_TAIL(bgm_crossfade_s16_scalar, ma_int16);
+}
+
+BGM_TARGET_AVX2 inline void bgm_crossfade_f32_avx2(
+    void* dst, const void* a, const void* b, const float* gainA,
+    const float* gainB, ma_uint32 frames, ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_crossfade_f32_scalar(dst, a, b, gainA, gainB, frames, channels);
+
+  float* out = (float*)dst;
+  const float* x = (const float*)a;
+  const float* y = (const float*)b;
+  // 4 帧的增益 g0 g1 g2 g3 展开成 g0 g0 g1 g1 g2 g2 g3 g3
+  const __m256i spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    __m256 ga = _mm256_permutevar8x32_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(gainA + done)), spread);
+    __m256 gb = _mm256_permutevar8x32_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(gainB + done)), spread);
+    __m256 u = _mm256_mul_ps(_mm256_loadu_ps(x + done * 2), ga);
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(y + done * 2), gb);
+    _mm256_storeu_ps(out + done * 2, _mm256_add_ps(u, v));
+  }
+
+  BGM_CROSSFADE_TAIL(bgm_crossfade_f32_scalar, float);
+}
+
+BGM_TARGET_AVX2 inline void bgm_crossfade_s16_avx2(
+    void* dst, const void* a, const void* b, const float* gainA,
+    const float* gainB, ma_uint32 frames, ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_crossfade_s16_scalar(dst, a, b, gainA, gainB, frames, channels);
+
+  ma_int16* out = (ma_int16*)dst;
+  const ma_int16* x = (const ma_int16*)a;
+  const ma_int16* y = (const ma_int16*)b;
+  const __m256i spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+  const __m256 lo = _mm256_set1_ps(-32768.0f);
+  const __m256 hi = _mm256_set1_ps(32767.0f);
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    __m256 fx = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i*)(x + done * 2))));
+    __m256 fy = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i*)(y + done * 2))));
+    __m256 ga = _mm256_permutevar8x32_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(gainA + done)), spread);
+    __m256 gb = _mm256_permutevar8x32_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(gainB + done)), spread);
+
+    __m256 m = _mm256_add_ps(_mm256_mul_ps(fx, ga), _mm256_mul_ps(fy, gb));
+    __m256i i = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(m, lo), hi));
+    // 两半分别 pack 后正好是前 8 个样本
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(i),
+                                     _mm256_extracti128_si256(i, 1));
+    _mm_storeu_si128((__m128i*)(out + done * 2), packed);
+  }
+
+  BGM_CROSSFADE_TAIL(bgm_crossfade_s16_scalar, ma_int16);
+}
+
+#endif
+
+#if defined(BGM_ARM64)
+
+inline void bgm_crossfade_f32_neon(void* dst, const void* a, const void* b,
+                                   const float* gainA, const float* gainB,
+                                   ma_uint32 frames, ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_crossfade_f32_scalar(dst, a, b, gainA, gainB, frames, channels);
+
+  float* out = (float*)dst;
+  const float* x = (const float*)a;
+  const float* y = (const float*)b;
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    // vld2 按声道拆开，正好和每帧一个的增益对齐
+    float32x4x2_t fx = vld2q_f32(x + done * 2);
+    float32x4x2_t fy = vld2q_f32(y + done * 2);
+    float32x4_t ga = vld1q_f32(gainA + done);
+    float32x4_t gb = vld1q_f32(gainB + done);
+    float32x4x2_t m;
+    m.val[0] = vaddq_f32(vmulq_f32(fx.val[0], ga), vmulq_f32(fy.val[0], gb));
+    m.val[1] = vaddq_f32(vmulq_f32(fx.val[1], ga), vmulq_f32(fy.val[1], gb));
+    vst2q_f32(out + done * 2, m);
+  }
+
+  BGM_CROSSFADE_TAIL(bgm_crossfade_f32_scalar, float);
+}
+
+inline void bgm_crossfade_s16_neon(void* dst, const void* a, const void* b,
+                                   const float* gainA, const float* gainB,
+                                   ma_uint32 frames, ma_uint32 channels) {
+  if (channels != 2)
+    return bgm_crossfade_s16_scalar(dst, a, b, gainA, gainB, frames, channels);
+
+  ma_int16* out = (ma_int16*)dst;
+  const ma_int16* x = (const ma_int16*)a;
+  const ma_int16* y = (const ma_int16*)b;
+  const float32x4_t lo = vdupq_n_f32(-32768.0f);
+  const float32x4_t hi = vdupq_n_f32(32767.0f);
+
+  ma_uint32 done = 0;
+  for (; done + 4 <= frames; done += 4) {
+    int16x4x2_t ix = vld2_s16(x + done * 2);
+    int16x4x2_t iy = vld2_s16(y + done * 2);
+    float32x4_t ga = vld1q_f32(gainA + done);
+    float32x4_t gb = vld1q_f32(gainB + done);
+    int16x4x2_t m;
+    for (int c = 0; c < 2; c++) {
+      float32x4_t fx = vcvtq_f32_s32(vmovl_s16(ix.val[c]));
+      float32x4_t fy = vcvtq_f32_s32(vmovl_s16(iy.val[c]));
+      float32x4_t f = vaddq_f32(vmulq_f32(fx, ga), vmulq_f32(fy, gb));
+      m.val[c] = vqmovn_s32(vcvtnq_s32_f32(vminq_f32(vmaxq_f32(f, lo), hi)));
+    }
+    vst2_s16(out + done * 2, m);
+  }
+
+  BGM_CROSSFADE_TAIL(bgm_crossfade_s16_scalar, ma_int16);
+}
+
+#endif
+
+#undef BGM_CROSSFADE_TAIL
+
+/**
+ * 查找输出格式 format 的交叉淡化内核
+ *
+ * params
+ * simd 指定指令集，bgm_simd_best 表示运行时检测
+ *
+ * return
+ * nullptr 不支持的格式，或者当前平台不支持指定的指令集
+ */
+bgm_crossfade_proc inline bgm_crossfade_find(ma_format format,
+                                             bgm_simd simd = bgm_simd_best) {
+  static const struct {
+    ma_format format;
+    bgm_crossfade_proc procs[4]; /*按 bgm_simd 排列*/
+  } kernels[] = {
+#if defined(BGM_X64)
+      {ma_format_f32,
+       {bgm_crossfade_f32_scalar, bgm_crossfade_f32_sse2,
+        bgm_crossfade_f32_avx2, nullptr}},
+      {ma_format_s16,
+       {bgm_crossfade_s16_scalar, bgm_crossfade_s16_sse2,
+        bgm_crossfade_s16_avx2, nullptr}},
+#elif defined(BGM_ARM64)
+      {ma_format_f32,
+       {bgm_crossfade_f32_scalar, nullptr, nullptr, bgm_crossfade_f32_neon}},
+      {ma_format_s16,
+       {bgm_crossfade_s16_scalar, nullptr, nullptr, bgm_crossfade_s16_neon}},
+#else
+      {ma_format_f32, {bgm_crossfade_f32_scalar, nullptr, nullptr, nullptr}},
+      {ma_format_s16, {bgm_crossfade_s16_scalar, nullptr, nullptr, nullptr}},
+#endif
+  };
+
+  static const bgm_simd best = bgm_simd_detect();
+  if (simd == bgm_simd_best) simd = best;
+  if (simd > best) return nullptr;
+
+  for (auto& kernel : kernels) {
+    if (kernel.format == format) return kernel.procs[simd];
+  }
+
+  return nullptr;
+}
+
+/**
+ * 累加内核：acc[i] += src[i] * gain
+ *
+ * params
+ * samples 样本数（帧数 × 声道数）
+ */
+typedef void (*bgm_accumulate_proc)(float* acc, const void* src, float gain,
+                                    ma_uint64 samples);
+
+/**
+ * 输出内核：把累加缓冲区饱和到输出格式
+ */
+typedef void (*bgm_store_proc)(void* dst, const float* acc, ma_uint64 samples);
+
+inline void bgm_accumulate_f32_scalar(float* acc, const void* src, float gain,
+                                      ma_uint64 samples) {
+  const float* x = (const float*)src;
+  for (ma_uint64 i = 0; i < samples; i++) {
+    float v = x[i] * gain;
+    acc[i] = acc[i] + v;
+  }
+}
+
+inline void bgm_accumulate_s16_scalar(float* acc, const void* src, float gain,
+                                      ma_uint64 samples) {
+  const ma_int16* x = (const ma_int16*)src;
+  for (ma_uint64 i = 0; i < samples; i++) {
+    float v = (float)x[i] * gain;
+    acc[i] = acc[i] + v;
+  }
+}
+
+inline void bgm_store_f32_scalar(void* dst, const float* acc,
+                                 ma_uint64 samples) {
+  float* out = (float*)dst;
+  for (ma_uint64 i = 0; i < samples; i++) {
+    float v = acc[i];
+    out[i] = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+  }
+}
+
+inline void bgm_store_s16_scalar(void* dst, const float* acc,
+                                 ma_uint64 samples) {
+  ma_int16* out = (ma_int16*)dst;
+  for (ma_uint64 i = 0; i < samples; i++) {
+    float v = acc[i];
+    v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+    out[i] = (ma_int16)lrintf(v);
+  }
+}
+
+#if defined(BGM_X64)
+
+inline void bgm_accumulate_f32_sse2(float* acc, const void* src, float gain,
+                                    ma_uint64 samples) {
+  const float* x = (const float*)src;
+  const __m128 g = _mm_set1_ps(gain);
+  ma_uint64 i = 0;
+  for (; i + 4 <= samples; i += 4) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(x + i), g);
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), v));
+  }
+  bgm_accumulate_f32_scalar(acc + i, x + i, gain, samples - i);
+}
+
+inline void bgm_accumulate_s16_sse2(float* acc, const void* src, float gain,
+                                    ma_uint64 samples) {
+  const ma_int16* x = (const ma_int16*)src;
+  const __m128 g = _mm_set1_ps(gain);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128i ix = _mm_loadu_si128((const __m128i*)(x + i));
+    __m128 x0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(ix, ix), 16));
+    __m128 x1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(ix, ix), 16));
+    _mm_storeu_ps(acc + i,
+                  _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(x0, g)));
+    _mm_storeu_ps(acc + i + 4,
+                  _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(x1, g)));
+  }
+  bgm_accumulate_s16_scalar(acc + i, x + i, gain, samples - i);
+}
+
+inline void bgm_store_f32_sse2(void* dst, const float* acc,
+                               ma_uint64 samples) {
+  float* out = (float*)dst;
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  ma_uint64 i = 0;
+  for (; i + 4 <= samples; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), lo), hi));
+  bgm_store_f32_scalar(out + i, acc + i, samples - i);
+}
+
+inline void bgm_store_s16_sse2(void* dst, const float* acc,
+                               ma_uint64 samples) {
+  ma_int16* out = (ma_int16*)dst;
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128i i0 = _mm_cvtps_epi32(
+        _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), lo), hi));
+    __m128i i1 = _mm_cvtps_epi32(
+        _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i + 4), lo), hi));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(i0, i1));
+  }
+  bgm_store_s16_scalar(out + i, acc + i, samples - i);
+}
+
+BGM_TARGET_AVX2 inline void bgm_accumulate_f32_avx2(float* acc,
+                                                    const void* src,
+                                                    float gain,
+                                                    ma_uint64 samples) {
+  const float* x = (const float*)src;
+  const __m256 g = _mm256_set1_ps(gain);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(x + i), g);
+    _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), v));
+  }
+  bgm_accumulate_f32_scalar(acc + i, x + i, gain, samples - i);
+}
+
+BGM_TARGET_AVX2 inline void bgm_accumulate_s16_avx2(float* acc,
+                                                    const void* src,
+                                                    float gain,
+                                                    ma_uint64 samples) {
+  const ma_int16* x = (const ma_int16*)src;
+  const __m256 g = _mm256_set1_ps(gain);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256 v = _mm256_cvtepi32_ps(
+        _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + i))));
+    _mm256_storeu_ps(
+        acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(v, g)));
+  }
+  bgm_accumulate_s16_scalar(acc + i, x + i, gain, samples - i);
+}
+
+BGM_TARGET_AVX2 inline void bgm_store_f32_avx2(void* dst, const float* acc,
+                                               ma_uint64 samples) {
+  float* out = (float*)dst;
+  const __m256 lo = _mm256_set1_ps(-1.0f);
+  const __m256 hi = _mm256_set1_ps(1.0f);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8)
+    _mm256_storeu_ps(
+        out + i,
+        _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(acc + i), lo), hi));
+  bgm_store_f32_scalar(out + i, acc + i, samples - i);
+}
+
+BGM_TARGET_AVX2 inline void bgm_store_s16_avx2(void* dst, const float* acc,
+                                               ma_uint64 samples) {
+  ma_int16* out = (ma_int16*)dst;
+  const __m256 lo = _mm256_set1_ps(-32768.0f);
+  const __m256 hi = _mm256_set1_ps(32767.0f);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256i v = _mm256_cvtps_epi32(
+        _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(acc + i), lo), hi));
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v),
+                                     _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128((__m128i*)(out + i), packed);
+  }
+  bgm_store_s16_scalar(out + i, acc + i, samples - i);
+}
+
+#endif
+
+#if defined(BGM_ARM64)
+
+inline void bgm_accumulate_f32_neon(float* acc, const void* src, float gain,
+                                    ma_uint64 samples) {
+  const float* x = (const float*)src;
+  ma_uint64 i = 0;
+  for (; i + 4 <= samples; i += 4) {
+    float32x4_t v = vmulq_n_f32(vld1q_f32(x + i), gain);
+    vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), v));
+  }
+  bgm_accumulate_f32_scalar(acc + i, x + i, gain, samples - i);
+}
+
+inline void bgm_accumulate_s16_neon(float* acc, const void* src, float gain,
+                                    ma_uint64 samples) {
+  const ma_int16* x = (const ma_int16*)src;
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    int16x8_t ix = vld1q_s16(x + i);
+    float32x4_t x0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(ix)));
+    float32x4_t x1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(ix)));
+    vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), vmulq_n_f32(x0, gain)));
+    vst1q_f32(acc + i + 4,
+              vaddq_f32(vld1q_f32(acc + i + 4), vmulq_n_f32(x1, gain)));
+  }
+  bgm_accumulate_s16_scalar(acc + i, x + i, gain, samples - i);
+}
+
+inline void bgm_store_f32_neon(void* dst, const float* acc,
+                               ma_uint64 samples) {
+  float* out = (float*)dst;
+  const float32x4_t lo = vdupq_n_f32(-1.0f);
+  const float32x4_t hi = vdupq_n_f32(1.0f);
+  ma_uint64 i = 0;
+  for (; i + 4 <= samples; i += 4)
+    vst1q_f32(out + i, vminq_f32(vmaxq_f32(vld1q_f32(acc + i), lo), hi));
+  bgm_store_f32_scalar(out + i, acc + i, samples - i);
+}
+
+inline void bgm_store_s16_neon(void* dst, const float* acc,
+                               ma_uint64 samples) {
+  ma_int16* out = (ma_int16*)dst;
+  const float32x4_t lo = vdupq_n_f32(-32768.0f);
+  const float32x4_t hi = vdupq_n_f32(32767.0f);
+  ma_uint64 i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    int32x4_t i0 =
+        vcvtnq_s32_f32(vminq_f32(vmaxq_f32(vld1q_f32(acc + i), lo), hi));
+    int32x4_t i1 =
+        vcvtnq_s32_f32(vminq_f32(vmaxq_f32(vld1q_f32(acc + i + 4), lo), hi));
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(i0), vqmovn_s32(i1)));
+  }
+  bgm_store_s16_scalar(out + i, acc + i, samples - i);
+}
+
+#endif
+
+/**
+ * 查找输入格式 format 的累加内核
+ *
+ * return
+ * nullptr 不支持的格式，或者当前平台不支持指定的指令集
+ */
+bgm_accumulate_proc inline bgm_accumulate_find(ma_format format,
+                                               bgm_simd simd = bgm_simd_best) {
+  static const struct {
+    ma_format format;
+    bgm_accumulate_proc procs[4]; /*按 bgm_simd 排列*/
+  } kernels[] = {
+#if defined(BGM_X64)
+      {ma_format_f32,
+       {bgm_accumulate_f32_scalar, bgm_accumulate_f32_sse2,
+        bgm_accumulate_f32_avx2, nullptr}},
+      {ma_format_s16,
+       {bgm_accumulate_s16_scalar, bgm_accumulate_s16_sse2,
+        bgm_accumulate_s16_avx2, nullptr}},
+#elif defined(BGM_ARM64)
+      {ma_format_f32,
+       {bgm_accumulate_f32_scalar, nullptr, nullptr, bgm_accumulate_f32_neon}},
+      {ma_format_s16,
+       {bgm_accumulate_s16_scalar, nullptr, nullptr, bgm_accumulate_s16_neon}},
+#else
+      {ma_format_f32, {bgm_accumulate_f32_scalar, nullptr, nullptr, nullptr}},
+      {ma_format_s16, {bgm_accumulate_s16_scalar, nullptr, nullptr, nullptr}},
+#endif
+  };
+
+  static const bgm_simd best = bgm_simd_detect();
+  if (simd == bgm_simd_best) simd = best;
+  if (simd > best) return nullptr;
+
+  for (auto& kernel : kernels) {
+    if (kernel.format == format) return kernel.procs[simd];
+  }
+
+  return nullptr;
+}
+
+/**
+ * 查找输出格式 format 的输出内核
+ *
+ * return
+ * nullptr 不支持的格式，或者当前平台不支持指定的指令集
+ */
+bgm_store_proc inline bgm_store_find(ma_format format,
+                                     bgm_simd simd = bgm_simd_best) {
+  static const struct {
+    ma_format format;
+    bgm_store_proc procs[4]; /*按 bgm_simd 排列*/
+  } kernels[] = {
+#if defined(BGM_X64)
+      {ma_format_f32,
+       {bgm_store_f32_scalar, bgm_store_f32_sse2, bgm_store_f32_avx2,
+        nullptr}},
+      {ma_format_s16,
+       {bgm_store_s16_scalar, bgm_store_s16_sse2, bgm_store_s16_avx2,
+        nullptr}},
+#elif defined(BGM_ARM64)
+      {ma_format_f32,
+       {bgm_store_f32_scalar, nullptr, nullptr, bgm_store_f32_neon}},
+      {ma_format_s16,
+       {bgm_store_s16_scalar, nullptr, nullptr, bgm_store_s16_neon}},
+#else
+      {ma_format_f32, {bgm_store_f32_scalar, nullptr, nullptr, nullptr}},
+      {ma_format_s16, {bgm_store_s16_scalar, nullptr, nullptr, nullptr}},
+#endif
+  };
+
+  static const bgm_simd best = bgm_simd_detect();
+  if (simd == bgm_simd_best) simd = best;
+  if (simd > best) return nullptr;
+
+  for (auto& kernel : kernels) {
+    if (kernel.format == format) return kernel.procs[simd];
+  }
+
+  return nullptr;
+}
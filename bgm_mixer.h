@@ -0,0 +1,331 @@
+#pragma once
+
+/*
+一个 ma_device 上混合多路音频。
+
+每个 Bgm 都有自己的设备、后端音频流和播放线程，叠加多轨分轨音乐时由系统混音器
+完成混音。BgmMixer 只打开一个设备，在同一个回调中读取所有注册的数据源
+（bgm_source.h 或者任何 ma_data_source），乘以各自的增益后用 SIMD 内核
+（bgm_mix.h）累加，最后一次性饱和到设备格式。
+
+数据源放在固定数量的槽位中，add/remove/set_gain 只用原子操作，播放线程不加锁。
+remove 把槽位清空后等待正在进行的回调结束，返回后调用者就可以释放数据源
+*/
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bgm.h"
+#include "bgm_context.h"
+#include "bgm_mix.h"
+#include "bgm_source.h"
+#include "bgm_telemetry.h"
+#include "miniaudio.h"
+
+/*
+每次混音的帧数，决定累加缓冲区的大小
+*/
+#define BGM_MIX_CHUNK 512
+
+typedef struct {
+  ma_format format; /*设备格式，支持 ma_format_s16 和 ma_format_f32*/
+  ma_uint32 channels;
+  ma_uint32 sampleRate;
+  ma_uint32 maxSources; /*槽位数，add 超出时返回 BGM_MIXER_FULL*/
+  bgm_simd simd;        /*累加和输出内核的指令集*/
+  /*
+  不创建设备，由调用者用 mix 拉取混音结果，用于离线渲染和性能测试
+  */
+  ma_bool32 noDevice;
+  ma_bool32 sharedContext; /*设备使用共享的 ma_context，见 bgm_config*/
+  ma_bool32 callbackTelemetry; /*记录回调的计时统计，见 bgm_config*/
+} bgm_mixer_config;
+
+bgm_mixer_config inline bgm_mixer_config_init() {
+  bgm_mixer_config config;
+  config.format = ma_format_s16;
+  config.channels = 2;
+  config.sampleRate = 48000;
+  config.maxSources = 32;
+  config.simd = bgm_simd_best;
+  config.noDevice = MA_FALSE;
+  config.sharedContext = MA_TRUE;
+  config.callbackTelemetry = MA_FALSE;
+  return config;
+}
+
+/*
+数据源欠载的统计，和 Bgm 的 bgm_pipeline_stats.underruns 一致。
+只能识别 bgm_data_source 补齐的静音，其他数据源读不满时当作结束
+*/
+typedef struct {
+  ma_uint64 underruns;     /*某个数据源补齐静音的次数，每块混音每个数据源算一次*/
+  ma_uint64 missingFrames; /*补齐的静音帧数，所有数据源的合计*/
+} bgm_mixer_stats;
+
+class BgmMixer {
+ private:
+  typedef struct {
+    std::atomic<bool> claimed{false};  // add 占用槽位，remove 之后才释放
+    std::atomic<ma_data_source*> source{nullptr};
+    std::atomic<float> gain{1.0f};
+  } slot;
+
+  std::unique_ptr<slot[]> slots;
+  ma_uint32 slotCount = 0;
+
+  // 播放线程每次混音前后各加一，奇数表示正在混音，remove 用它等待回调结束。
+  // 和槽位的 source 都用顺序一致的原子操作，remove 清空槽位之后读到偶数时
+  // 之后的回调一定看不到这个数据源
+  std::atomic<ma_uint64> epoch{0};
+
+  std::vector<float> acc;         // 累加缓冲区
+  std::vector<ma_uint8> scratch;  // 一个数据源的一块样本
+  bgm_accumulate_proc accumulate = nullptr;
+  bgm_store_proc store = nullptr;
+
+  ma_device device;
+  bool deviceInitialized = false;
+  ma_context* context = nullptr;
+
+  BgmCallbackTelemetry telemetry;
+  // 只由播放线程写入
+  std::atomic<ma_uint64> underruns{0};
+  std::atomic<ma_uint64> missingFrames{0};
+
+ private:
+  static void _data_callback(ma_device* pDevice, void* pOutput,
+                             const void* pInput, ma_uint32 frameCount) {
+    BgmMixer* mixer = (BgmMixer*)pDevice->pUserData;
+    if (mixer == NULL) return;
+
+    if (!mixer->config.callbackTelemetry) {
+      mixer->mix(pOutput, frameCount);
+    } else {
+      int64_t begin = bgm_now_ns();
+      ma_uint32 framesMixed = mixer->mix(pOutput, frameCount);
+      mixer->telemetry.record(begin, bgm_now_ns(), frameCount, framesMixed,
+                              pDevice->sampleRate);
+    }
+    (void)pInput;
+  }
+
+  // 只有播放线程写入，不需要 fetch_add
+  static void _add(std::atomic<ma_uint64>& counter, ma_uint64 value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  slot* _find(ma_data_source* source) {
+    for (ma_uint32 i = 0; i < slotCount; i++)
+      if (slots[i].source.load() == source) return &slots[i];
+    return nullptr;
+  }
+
+ public:
+  bgm_mixer_config config;
+
+ public:
+  BgmMixer() : config{bgm_mixer_config_init()} {}
+  explicit BgmMixer(const bgm_mixer_config& config) : config{config} {}
+  ~BgmMixer() { uninit(); }
+
+  /**
+   * 分配槽位和混音缓冲区，打开设备（不会开始播放）
+   *
+   * return
+   * 0 ok
+   */
+  bgm_result init() {
+    if ((accumulate = bgm_accumulate_find(config.format, config.simd)) ==
+            nullptr ||
+        (store = bgm_store_find(config.format, config.simd)) == nullptr) {
+      accumulate = bgm_accumulate_find(config.format, bgm_simd_scalar);
+      store = bgm_store_find(config.format, bgm_simd_scalar);
+    }
+    if (accumulate == nullptr || store == nullptr || config.channels == 0)
+      return BGM_OUTPUT_FORMAT;
+
+    slotCount = config.maxSources;
+    slots = std::make_unique<slot[]>(slotCount);
+    acc.resize((size_t)BGM_MIX_CHUNK * config.channels);
+    scratch.resize((size_t)BGM_MIX_CHUNK *
+                   ma_get_bytes_per_frame(config.format, config.channels));
+
+    if (config.noDevice) return BGM_OK;
+
+    ma_device_config deviceConfig =
+        ma_device_config_init(ma_device_type_playback);
+    deviceConfig.playback.format = config.format;
+    deviceConfig.playback.channels = config.channels;
+    deviceConfig.sampleRate = config.sampleRate;
+    deviceConfig.dataCallback = _data_callback;
+    deviceConfig.pUserData = this;
+
+    if (config.sharedContext && (context = bgm_context_acquire()) == nullptr)
+      return BGM_CONTEXT_INIT;
+
+    if (ma_device_init(context, &deviceConfig, &device) != MA_SUCCESS)
+      return BGM_DEVICE_INIT;
+    deviceInitialized = true;
+    return BGM_OK;
+  }
+
+  /**
+   * 关闭设备，不会释放注册的数据源
+   */
+  void uninit() {
+    if (deviceInitialized) ma_device_uninit(&device);
+    deviceInitialized = false;
+    if (context != nullptr) bgm_context_release();
+    context = nullptr;
+    slots.reset();
+    slotCount = 0;
+  }
+
+  bgm_result play() {
+    if (!deviceInitialized || ma_device_start(&device) != MA_SUCCESS)
+      return BGM_PLAY;
+    return BGM_OK;
+  }
+
+  bgm_result pause() {
+    if (!deviceInitialized || ma_device_stop(&device) != MA_SUCCESS)
+      return BGM_PAUSE;
+    return BGM_OK;
+  }
+
+  /**
+   * 注册一个数据源，下一次回调开始混音。不能在播放线程调用
+   *
+   * params
+   * source 格式、声道数和采样率必须和混音器相同，同一个数据源只能注册一次
+   * gain 线性增益
+   *
+   * return
+   * 0 ok，BGM_OUTPUT_FORMAT 表示格式不同，BGM_MIXER_FULL 表示没有空槽位
+   */
+  bgm_result add(ma_data_source* source, float gain = 1.0f) {
+    ma_format format;
+    ma_uint32 channels, sampleRate;
+    if (ma_data_source_get_data_format(source, &format, &channels, &sampleRate,
+                                       NULL, 0) != MA_SUCCESS ||
+        format != config.format || channels != config.channels ||
+        sampleRate != config.sampleRate)
+      return BGM_OUTPUT_FORMAT;
+
+    for (ma_uint32 i = 0; i < slotCount; i++) {
+      bool expected = false;
+      if (!slots[i].claimed.compare_exchange_strong(expected, true)) continue;
+      // 先写增益再发布数据源，播放线程看到数据源时增益一定已经生效
+      slots[i].gain.store(gain);
+      slots[i].source.store(source);
+      return BGM_OK;
+    }
+    return BGM_MIXER_FULL;
+  }
+
+  /**
+   * 注销数据源，返回后播放线程不会再访问它，可以立即释放。
+   * 正在混音时等待这次回调结束，不能在播放线程调用
+   *
+   * return
+   * false 数据源没有注册
+   */
+  bool remove(ma_data_source* source) {
+    slot* s = _find(source);
+    if (s == nullptr) return false;
+    s->source.store(nullptr);
+
+    ma_uint64 e = epoch.load();
+    if (e & 1) {
+      while (epoch.load() == e) std::this_thread::yield();
+    }
+    s->claimed.store(false);
+    return true;
+  }
+
+  /**
+   * 修改数据源的增益，下一块混音开始生效
+   *
+   * return
+   * false 数据源没有注册
+   */
+  bool set_gain(ma_data_source* source, float gain) {
+    slot* s = _find(source);
+    if (s == nullptr) return false;
+    s->gain.store(gain);
+    return true;
+  }
+
+  /**
+   * 获取播放回调的计时统计，需要打开 callbackTelemetry，可以在其他线程调用
+   */
+  bgm_callback_stats get_callback_stats() const {
+    return telemetry.get_stats();
+  }
+
+  /**
+   * 获取数据源欠载的统计，可以在其他线程调用
+   */
+  bgm_mixer_stats get_stats() const {
+    bgm_mixer_stats stats;
+    stats.underruns = underruns.load(std::memory_order_relaxed);
+    stats.missingFrames = missingFrames.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  /**
+   * 混合所有注册的数据源，由播放线程调用，noDevice 时由调用者调用。
+   * 读完的数据源输出静音，直到被 remove
+   *
+   * return
+   * 至少有一个数据源提供了解码样本的帧数，其余是静音
+   */
+  ma_uint32 mix(void* pOutput, ma_uint32 frameCount) {
+    epoch.fetch_add(1);
+
+    ma_uint32 channels = config.channels;
+    ma_uint32 framesMixed = 0;
+    for (ma_uint32 done = 0; done < frameCount;) {
+      ma_uint32 n = std::min<ma_uint32>(frameCount - done, BGM_MIX_CHUNK);
+      std::fill(acc.begin(), acc.begin() + (size_t)n * channels, 0.0f);
+      ma_uint64 live = 0;
+
+      for (ma_uint32 i = 0; i < slotCount; i++) {
+        ma_data_source* source = slots[i].source.load();
+        if (source == nullptr) continue;
+
+        // bgm_data_source 欠载时补齐静音并按读满返回，从它的计数中减掉
+        bgm_data_source* bgm =
+            ((ma_data_source_base*)source)->vtable == &bgm_data_source_vtable
+                ? (bgm_data_source*)source
+                : nullptr;
+        ma_uint64 silence = bgm ? bgm->silenceFrames.load() : 0;
+
+        ma_uint64 framesRead = 0;
+        ma_data_source_read_pcm_frames(source, scratch.data(), n, &framesRead);
+        accumulate(acc.data(), scratch.data(),
+                   slots[i].gain.load(std::memory_order_relaxed),
+                   framesRead * channels);
+
+        ma_uint64 padded = bgm ? bgm->silenceFrames.load() - silence : 0;
+        if (padded > 0) {
+          _add(underruns, 1);
+          _add(missingFrames, padded);
+        }
+        live = std::max(live, framesRead - padded);
+      }
+
+      store(ma_offset_pcm_frames_ptr(pOutput, done, config.format, channels),
+            acc.data(), (ma_uint64)n * channels);
+      framesMixed += (ma_uint32)live;
+      done += n;
+    }
+
+    epoch.fetch_add(1);
+    return framesMixed;
+  }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+/*
+把整个文件只读映射到内存，Windows 用 CreateFileMapping，其他平台用 mmap
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+  const uint8_t* data; /*文件内容，空文件时为 nullptr*/
+  size_t size;         /*文件大小*/
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+} bgm_mmap;
+
+/**
+ * 只读映射整个文件
+ *
+ * return
+ * false 打开或者映射失败
+ */
+bool inline bgm_mmap_open(bgm_mmap* m, const char* path) {
+  m->data = nullptr;
+  m->size = 0;
+
+#ifdef _WIN32
+  m->mapping = NULL;
+  m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m->file == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m->file, &size)) {
+    CloseHandle(m->file);
+    return false;
+  }
+  m->size = (size_t)size.QuadPart;
+  if (m->size == 0) return true;
+
+  m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (m->mapping != NULL)
+    m->data = (const uint8_t*)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (m->data == nullptr) {
+    if (m->mapping != NULL) CloseHandle(m->mapping);
+    CloseHandle(m->file);
+    return false;
+  }
+#else
+  if ((m->fd = open(path, O_RDONLY)) < 0) return false;
+
+  struct stat st;
+  if (fstat(m->fd, &st) != 0) {
+    close(m->fd);
+    return false;
+  }
+  m->size = (size_t)st.st_size;
+  if (m->size == 0) return true;
+
+  void* p = mmap(NULL, m->size, PROT_READ, MAP_SHARED, m->fd, 0);
+  if (p == MAP_FAILED) {
+    close(m->fd);
+    return false;
+  }
+  m->data = (const uint8_t*)p;
+#endif
+
+  return true;
+}
+
+/**
+ * 解除映射并关闭文件
+ */
+void inline bgm_mmap_close(bgm_mmap* m) {
+#ifdef _WIN32
+  if (m->data != nullptr) UnmapViewOfFile(m->data);
+  if (m->mapping != NULL) CloseHandle(m->mapping);
+  CloseHandle(m->file);
+#else
+  if (m->data != nullptr) munmap((void*)m->data, m->size);
+  close(m->fd);
+#endif
+  m->data = nullptr;
+  m->size = 0;
+}
+
+/**
+ * 提示内核会顺序读取整个映射，加大预读并尽快回收读过的页
+ */
+void inline bgm_mmap_advise_sequential(const bgm_mmap* m) {
+#ifndef _WIN32
+  if (m->data != nullptr) madvise((void*)m->data, m->size, MADV_SEQUENTIAL);
+#else
+  (void)m;  // Windows 没有对应的提示
+#endif
+}
+
+/**
+ * 提示内核马上会读取 [offset, offset + size)，提前读入页缓存
+ */
+void inline bgm_mmap_willneed(const bgm_mmap* m, size_t offset, size_t size) {
+#ifndef _WIN32
+  if (m->data == nullptr || offset >= m->size) return;
+
+  // madvise 的地址必须按页对齐
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t begin = offset & ~(page - 1);
+  size_t end = std::min(offset + size, m->size);
+  madvise((void*)(m->data + begin), end - begin, MADV_WILLNEED);
+#else
+  (void)m, (void)offset, (void)size;
+#endif
+}
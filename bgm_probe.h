@@ -0,0 +1,310 @@
+#pragma once
+
+/*
+avformat_find_stream_info 结果的磁盘缓存。
+
+avformat_find_stream_info 需要读取并解码一部分包才能得到流的参数，
+对 MPEG-TS、裸 ADTS、没有 Xing 头的 VBR MP3 等格式是打开文件最慢的一步。
+第一次打开时把选中的音频流和它的 AVCodecParameters（包括 extradata）、
+时间基、时长保存下来，再次打开同一个文件时直接填回 AVStream，跳过探测。
+key 和解码结果缓存一样由绝对路径、大小和修改时间组成（bgm_file_key）。
+
+同一个目录下还保存音频流的包索引（时间戳 → 字节位置），第一次从头解码到
+文件结尾时记录，之后 seek 可以直接跳到目标之前的包，不需要 ffmpeg 二分查找
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "bgm_cache.h"
+#include "miniaudio.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#define BGM_PROBE_MAGIC "BGMPRB1"
+#define BGM_PROBE_EXT ".probe"
+
+/*
+探测缓存文件的布局：header、key、extradata
+*/
+typedef struct {
+  char magic[8];          /*BGM_PROBE_MAGIC*/
+  ma_uint32 keySize;      /*key 的字节数，用来排除哈希冲突*/
+  ma_uint32 nbStreams;    /*avformat_open_input 之后容器中的流数*/
+  ma_int32 streamIndex;   /*选中的音频流*/
+  ma_int32 codecId;       /*AVCodecID*/
+  ma_uint32 codecTag;
+  ma_int32 format;        /*AVSampleFormat*/
+  ma_int64 bitRate;
+  ma_int32 bitsPerCodedSample;
+  ma_int32 bitsPerRawSample;
+  ma_int32 profile;
+  ma_int32 level;
+  ma_uint64 channelLayout;
+  ma_int32 channels;
+  ma_int32 sampleRate;
+  ma_int32 blockAlign;
+  ma_int32 frameSize;
+  ma_int32 initialPadding;
+  ma_int32 trailingPadding;
+  ma_int32 seekPreroll;
+  ma_int32 timeBaseNum;   /*AVStream::time_base*/
+  ma_int32 timeBaseDen;
+  ma_int32 extradataSize;
+  ma_int64 startTime;     /*AVStream::start_time*/
+  ma_int64 duration;      /*AVStream::duration*/
+  ma_int64 formatStartTime; /*AVFormatContext::start_time*/
+  ma_int64 formatDuration;  /*AVFormatContext::duration*/
+} bgm_probe_header;
+
+/**
+ * 读取探测缓存并填回 avformat_open_input 打开的 fmt，
+ * 代替 avformat_find_stream_info 和 av_find_best_stream
+ *
+ * 容器的流数、时间基或者已知的编码和缓存不一致时视为没有命中
+ *
+ * return
+ * 选中的音频流，-1 表示没有命中
+ */
+int inline bgm_probe_load(const std::string& dir, const std::string& key,
+                          AVFormatContext* fmt) {
+  std::string path = bgm_cache_path(dir, key, BGM_PROBE_EXT);
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return -1;
+
+  bgm_probe_header h;
+  std::vector<char> k(key.size());
+  std::vector<uint8_t> extradata;
+  bool ok = fread(&h, sizeof(h), 1, file) == 1 &&
+            memcmp(h.magic, BGM_PROBE_MAGIC, 8) == 0 &&
+            h.keySize == key.size() &&
+            fread(k.data(), 1, k.size(), file) == k.size() &&
+            memcmp(k.data(), key.data(), key.size()) == 0 &&
+            h.extradataSize >= 0;
+  if (ok) {
+    extradata.resize(h.extradataSize);
+    ok = fread(extradata.data(), 1, extradata.size(), file) ==
+         extradata.size();
+  }
+  fclose(file);
+  if (!ok) return -1;
+
+  if (h.nbStreams != fmt->nb_streams || h.streamIndex < 0 ||
+      (unsigned)h.streamIndex >= fmt->nb_streams)
+    return -1;
+
+  AVStream* stream = fmt->streams[h.streamIndex];
+  AVCodecParameters* par = stream->codecpar;
+  if (stream->time_base.num != h.timeBaseNum ||
+      stream->time_base.den != h.timeBaseDen ||
+      (par->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+       par->codec_type != AVMEDIA_TYPE_AUDIO) ||
+      (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != h.codecId))
+    return -1;
+
+  if (h.extradataSize > 0) {
+    uint8_t* p = (uint8_t*)av_mallocz(h.extradataSize +
+                                      AV_INPUT_BUFFER_PADDING_SIZE);
+    if (p == nullptr) return -1;
+    memcpy(p, extradata.data(), h.extradataSize);
+    av_freep(&par->extradata);
+    par->extradata = p;
+    par->extradata_size = h.extradataSize;
+  }
+
+  par->codec_type = AVMEDIA_TYPE_AUDIO;
+  par->codec_id = (AVCodecID)h.codecId;
+  par->codec_tag = h.codecTag;
+  par->format = h.format;
+  par->bit_rate = h.bitRate;
+  par->bits_per_coded_sample = h.bitsPerCodedSample;
+  par->bits_per_raw_sample = h.bitsPerRawSample;
+  par->profile = h.profile;
+  par->level = h.level;
+  par->channel_layout = h.channelLayout;
+  par->channels = h.channels;
+  par->sample_rate = h.sampleRate;
+  par->block_align = h.blockAlign;
+  par->frame_size = h.frameSize;
+  par->initial_padding = h.initialPadding;
+  par->trailing_padding = h.trailingPadding;
+  par->seek_preroll = h.seekPreroll;
+
+  // 时长和起始时间可能是探测时按码率估算的，只补上容器头里没有的
+  if (stream->start_time == AV_NOPTS_VALUE) stream->start_time = h.startTime;
+  if (stream->duration == AV_NOPTS_VALUE) stream->duration = h.duration;
+  if (fmt->start_time == AV_NOPTS_VALUE) fmt->start_time = h.formatStartTime;
+  if (fmt->duration == AV_NOPTS_VALUE) fmt->duration = h.formatDuration;
+
+  // 和解码缓存一样，修改时间就是最近使用时间，bgm_cache_evict 按它淘汰
+  std::error_code ec;
+  std::filesystem::last_write_time(
+      path, std::filesystem::file_time_type::clock::now(), ec);
+  return h.streamIndex;
+}
+
+/**
+ * 保存 avformat_find_stream_info 之后 fmt 中 streamIndex 的探测结果，
+ * 先写临时文件再改名，多个进程同时写入时不会读到一半的文件
+ *
+ * params
+ * nbStreams avformat_open_input 之后、探测之前的流数，bgm_probe_load 和它比较
+ */
+void inline bgm_probe_store(const std::string& dir, const std::string& key,
+                            const AVFormatContext* fmt, int streamIndex,
+                            unsigned nbStreams) {
+  const AVStream* stream = fmt->streams[streamIndex];
+  const AVCodecParameters* par = stream->codecpar;
+
+  bgm_probe_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BGM_PROBE_MAGIC, 8);
+  h.keySize = (ma_uint32)key.size();
+  h.nbStreams = nbStreams;
+  h.streamIndex = streamIndex;
+  h.codecId = par->codec_id;
+  h.codecTag = par->codec_tag;
+  h.format = par->format;
+  h.bitRate = par->bit_rate;
+  h.bitsPerCodedSample = par->bits_per_coded_sample;
+  h.bitsPerRawSample = par->bits_per_raw_sample;
+  h.profile = par->profile;
+  h.level = par->level;
+  h.channelLayout = par->channel_layout;
+  h.channels = par->channels;
+  h.sampleRate = par->sample_rate;
+  h.blockAlign = par->block_align;
+  h.frameSize = par->frame_size;
+  h.initialPadding = par->initial_padding;
+  h.trailingPadding = par->trailing_padding;
+  h.seekPreroll = par->seek_preroll;
+  h.timeBaseNum = stream->time_base.num;
+  h.timeBaseDen = stream->time_base.den;
+  h.extradataSize = par->extradata ? par->extradata_size : 0;
+  h.startTime = stream->start_time;
+  h.duration = stream->duration;
+  h.formatStartTime = fmt->start_time;
+  h.formatDuration = fmt->duration;
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+
+  std::string path = bgm_cache_path(dir, key, BGM_PROBE_EXT);
+  std::string temp =
+      path + "." +
+      std::to_string(
+          std::chrono::steady_clock::now().time_since_epoch().count()) +
+      ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (file == nullptr) return;
+
+  bool ok = fwrite(&h, sizeof(h), 1, file) == 1 &&
+            fwrite(key.data(), 1, key.size(), file) == key.size() &&
+            fwrite(par->extradata, 1, h.extradataSize, file) ==
+                (size_t)h.extradataSize;
+  ok = fclose(file) == 0 && ok;
+
+  if (ok) std::filesystem::rename(temp, path, ec);
+  if (!ok || ec) std::filesystem::remove(temp, ec);
+}
+
+#define BGM_INDEX_MAGIC "BGMIDX1"
+#define BGM_INDEX_EXT ".index"
+
+/*
+包索引中的一项：音频包的时间戳和它在文件中的字节位置
+*/
+typedef struct {
+  ma_int64 pts; /*AVStream::time_base 为单位*/
+  ma_int64 pos; /*AVPacket::pos*/
+} bgm_index_entry;
+
+/*
+包索引文件的布局：header、key、entries
+*/
+typedef struct {
+  char magic[8];        /*BGM_INDEX_MAGIC*/
+  ma_uint32 keySize;    /*key 的字节数，用来排除哈希冲突*/
+  ma_int32 streamIndex; /*索引的音频流*/
+  ma_uint64 count;      /*索引项的个数*/
+} bgm_index_header;
+
+/**
+ * 读取和探测缓存放在一起的包索引
+ *
+ * return
+ * false 没有索引文件或者和 key、streamIndex 不一致
+ */
+bool inline bgm_index_load(const std::string& dir, const std::string& key,
+                           int streamIndex,
+                           std::vector<bgm_index_entry>& entries) {
+  std::string path = bgm_cache_path(dir, key, BGM_INDEX_EXT);
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+
+  bgm_index_header h;
+  std::vector<char> k(key.size());
+  bool ok = fread(&h, sizeof(h), 1, file) == 1 &&
+            memcmp(h.magic, BGM_INDEX_MAGIC, 8) == 0 &&
+            h.keySize == key.size() && h.streamIndex == streamIndex &&
+            fread(k.data(), 1, k.size(), file) == k.size() &&
+            memcmp(k.data(), key.data(), key.size()) == 0;
+  // 项数必须和文件剩余的大小一致，损坏或者截断的文件不能决定分配多少内存
+  std::error_code ec;
+  ma_uint64 size = ok ? (ma_uint64)std::filesystem::file_size(path, ec) : 0;
+  ma_uint64 offset = sizeof(h) + key.size();
+  ok = ok && !ec && size >= offset &&
+       h.count == (size - offset) / sizeof(bgm_index_entry) &&
+       (size - offset) % sizeof(bgm_index_entry) == 0;
+  if (ok) {
+    entries.resize(h.count);
+    ok = fread(entries.data(), sizeof(bgm_index_entry), entries.size(),
+               file) == entries.size();
+  }
+  fclose(file);
+
+  if (!ok) entries.clear();
+  return ok;
+}
+
+/**
+ * 保存包索引，先写临时文件再改名
+ */
+void inline bgm_index_store(const std::string& dir, const std::string& key,
+                            int streamIndex,
+                            const std::vector<bgm_index_entry>& entries) {
+  bgm_index_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BGM_INDEX_MAGIC, 8);
+  h.keySize = (ma_uint32)key.size();
+  h.streamIndex = streamIndex;
+  h.count = entries.size();
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+
+  std::string path = bgm_cache_path(dir, key, BGM_INDEX_EXT);
+  std::string temp =
+      path + "." +
+      std::to_string(
+          std::chrono::steady_clock::now().time_since_epoch().count()) +
+      ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (file == nullptr) return;
+
+  bool ok = fwrite(&h, sizeof(h), 1, file) == 1 &&
+            fwrite(key.data(), 1, key.size(), file) == key.size() &&
+            fwrite(entries.data(), sizeof(bgm_index_entry), entries.size(),
+                   file) == entries.size();
+  ok = fclose(file) == 0 && ok;
+
+  if (ok) std::filesystem::rename(temp, path, ec);
+  if (!ok || ec) std::filesystem::remove(temp, ec);
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+/*
+解复用线程和解码线程之间的有界无锁队列，单生产者单消费者。
+
+每个槽位预先分配一个 AVPacket，解复用线程直接用 av_read_frame 填充槽位，
+解码线程用完后 unref，包的数据只是引用的转移，不会复制。
+队列空或者满时用 C++20 的 atomic wait/notify 阻塞，没有等待者时 notify
+不会进入内核
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bgm_time.h"
+#include "miniaudio.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+typedef struct {
+  ma_uint64 packets;      /*经过队列的包数*/
+  ma_uint32 capacity;     /*队列的槽位数*/
+  double fill;            /*每次取包时队列中包数的平均值*/
+  int64_t producerStall;  /*解复用线程等待空槽位的总时间，单位纳秒*/
+  int64_t consumerStall;  /*解码线程等待包的总时间，单位纳秒*/
+} bgm_queue_stats;
+
+class BgmPacketQueue {
+ private:
+  std::vector<AVPacket*> slots;
+  size_t mask = 0;
+
+  // head 只由消费者写，tail 只由生产者写，分开放在不同的缓存行
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+
+  // 每次 push/pop/finish/abort 都加一，阻塞的一方在它上面等待
+  alignas(64) std::atomic<uint32_t> signal{0};
+  std::atomic<bool> finished{false};  // 生产者不会再写入
+  std::atomic<bool> aborted{false};   // 双方都立即返回
+
+  std::atomic<ma_uint64> packets{0};
+  std::atomic<ma_uint64> fillSum{0};
+  std::atomic<int64_t> producerStall{0};
+  std::atomic<int64_t> consumerStall{0};
+
+ private:
+  void _notify() {
+    signal.fetch_add(1, std::memory_order_release);
+    signal.notify_all();
+  }
+
+ public:
+  ~BgmPacketQueue() { uninit(); }
+
+  /**
+   * 分配 capacity 个槽位，向上取整到 2 的幂
+   *
+   * return
+   * false 分配失败
+   */
+  bool init(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n *= 2;
+
+    slots.assign(n, nullptr);
+    for (AVPacket*& p : slots)
+      if ((p = av_packet_alloc()) == nullptr) return false;
+
+    mask = n - 1;
+    head = tail = 0;
+    finished = aborted = false;
+    packets = fillSum = 0;
+    producerStall = consumerStall = 0;
+    return true;
+  }
+
+  void uninit() {
+    for (AVPacket*& p : slots) av_packet_free(&p);
+    slots.clear();
+  }
+
+  /**
+   * 生产者：等待一个空槽位
+   *
+   * return
+   * 槽位中的 AVPacket，nullptr 表示队列被 abort
+   */
+  AVPacket* acquire_write() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    int64_t begin = 0;
+
+    for (;;) {
+      uint32_t s = signal.load(std::memory_order_acquire);
+      if (aborted.load()) return nullptr;
+      if (t - head.load(std::memory_order_acquire) < slots.size()) break;
+
+      if (begin == 0) begin = bgm_now_ns();
+      signal.wait(s, std::memory_order_acquire);
+    }
+
+    if (begin != 0) producerStall += bgm_now_ns() - begin;
+    return slots[t & mask];
+  }
+
+  /**
+   * 生产者：把 acquire_write 得到的包交给消费者
+   */
+  void commit_write() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+    _notify();
+  }
+
+  /**
+   * 生产者：不会再写入，消费者取完剩余的包后结束
+   */
+  void finish() {
+    finished = true;
+    _notify();
+  }
+
+  /**
+   * 消费者：等待一个包
+   *
+   * return
+   * 队首的 AVPacket，nullptr 表示生产者已经结束并且队列为空，或者被 abort
+   */
+  AVPacket* acquire_read() {
+    size_t h = head.load(std::memory_order_relaxed);
+    int64_t begin = 0;
+
+    for (;;) {
+      uint32_t s = signal.load(std::memory_order_acquire);
+      if (aborted.load()) return nullptr;
+      size_t t = tail.load(std::memory_order_acquire);
+      if (t != h) {
+        fillSum += t - h;
+        break;
+      }
+      if (finished.load()) return nullptr;
+
+      if (begin == 0) begin = bgm_now_ns();
+      signal.wait(s, std::memory_order_acquire);
+    }
+
+    if (begin != 0) consumerStall += bgm_now_ns() - begin;
+    return slots[h & mask];
+  }
+
+  /**
+   * 消费者：释放 acquire_read 得到的包，槽位还给生产者
+   */
+  void commit_read() {
+    size_t h = head.load(std::memory_order_relaxed);
+    av_packet_unref(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    packets++;
+    _notify();
+  }
+
+  /**
+   * 唤醒并结束双方，用于提前停止
+   */
+  void abort() {
+    aborted = true;
+    _notify();
+  }
+
+  /**
+   * 队列统计，可以在其他线程调用
+   */
+  bgm_queue_stats get_stats() const {
+    bgm_queue_stats stats;
+    stats.packets = packets.load();
+    stats.capacity = (ma_uint32)(mask ? mask + 1 : 0);
+    stats.fill = stats.packets ? (double)fillSum.load() / stats.packets : 0;
+    stats.producerStall = producerStall.load();
+    stats.consumerStall = consumerStall.load();
+    return stats;
+  }
+};
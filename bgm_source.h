@@ -0,0 +1,190 @@
+#pragma once
+
+/*
+把 BgmDecoder 包装成 miniaudio 的 ma_data_source。
+
+之后音轨可以交给 ma_data_source_node 接入 ma_node_graph，和其他声音一起混音，
+经过 biquad、delay 等效果节点，所有音轨共用一个设备和一个播放线程；
+也可以用 ma_sound_init_from_data_source 交给 ma_engine 播放。
+解码、缓存、循环和 seek 依然由 BgmDecoder 完成，这里只转发 vtable
+*/
+
+#include <atomic>
+
+#include "bgm.h"
+#include "miniaudio.h"
+
+typedef struct {
+  ma_data_source_base base; /*必须是第一个成员，miniaudio 按它访问*/
+  BgmDecoder* decoder;      /*由调用者创建和释放，生命周期要覆盖数据源*/
+  ma_uint64 cursor;         /*读取位置，输出的样本帧，不含补齐的静音*/
+  /*
+  环形缓冲区暂时为空时补齐的静音帧数和次数。只由播放线程写入，
+  其他线程可以随时读取
+  */
+  std::atomic<ma_uint64> silenceFrames;
+  std::atomic<ma_uint64> underruns;
+} bgm_data_source;
+
+/**
+ * 读取交错样本。streaming 模式下环形缓冲区暂时为空时剩余部分填充静音并
+ * 按读满返回，否则 miniaudio 会当作音轨结束；只有 BgmDecoder::at_end
+ * 才返回 MA_AT_END。补齐的静音记入 silenceFrames，不移动 cursor。
+ * pFramesOut 为 NULL 时读取后丢弃，相当于向前 seek
+ */
+ma_result inline bgm_data_source_read(ma_data_source* pDataSource,
+                                      void* pFramesOut, ma_uint64 frameCount,
+                                      ma_uint64* pFramesRead) {
+  bgm_data_source* source = (bgm_data_source*)pDataSource;
+  BgmDecoder* d = source->decoder;
+  ma_format format = d->config.format;
+  ma_uint32 channels = d->get_channels();
+  ma_uint32 bpf = ma_get_bytes_per_frame(format, channels);
+
+  // 丢弃的样本先读到栈上，播放线程中不分配内存
+  ma_uint8 discard[4096];
+  ma_uint64 framesRead = 0;
+  bool end = false;
+
+  while (framesRead < frameCount) {
+    ma_uint64 want = frameCount - framesRead;
+    void* dst;
+    if (pFramesOut != NULL) {
+      dst = ma_offset_pcm_frames_ptr(pFramesOut, framesRead, format, channels);
+      want = std::min<ma_uint64>(want, UINT32_MAX);
+    } else {
+      dst = discard;
+      want = std::min<ma_uint64>(want, sizeof(discard) / bpf);
+    }
+
+    ma_uint32 n = d->read_pcm_frames(dst, (ma_uint32)want);
+    framesRead += n;
+    if (n < want) {
+      end = d->at_end();
+      break;
+    }
+  }
+
+  source->cursor += framesRead;
+
+  // 解码线程暂时没有跟上，不是音轨结尾
+  if (!end && framesRead < frameCount) {
+    d->request_refill();
+    if (pFramesOut != NULL)
+      ma_silence_pcm_frames(
+          ma_offset_pcm_frames_ptr(pFramesOut, framesRead, format, channels),
+          frameCount - framesRead, format, channels);
+    source->silenceFrames.store(
+        source->silenceFrames.load(std::memory_order_relaxed) + frameCount -
+            framesRead,
+        std::memory_order_relaxed);
+    source->underruns.store(
+        source->underruns.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    framesRead = frameCount;
+  }
+
+  if (pFramesRead != NULL) *pFramesRead = framesRead;
+  return end && framesRead == 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+/**
+ * 转发给 BgmDecoder::seek_to_pcm_frame。streaming 模式下会停止并重启解码线程，
+ * 不能在播放线程调用
+ */
+ma_result inline bgm_data_source_seek(ma_data_source* pDataSource,
+                                      ma_uint64 frameIndex) {
+  bgm_data_source* source = (bgm_data_source*)pDataSource;
+  if (source->decoder->seek_to_pcm_frame(frameIndex) != BGM_OK)
+    return MA_ERROR;
+  source->cursor = frameIndex;
+  return MA_SUCCESS;
+}
+
+ma_result inline bgm_data_source_get_data_format(
+    ma_data_source* pDataSource, ma_format* pFormat, ma_uint32* pChannels,
+    ma_uint32* pSampleRate, ma_channel* pChannelMap, size_t channelMapCap) {
+  bgm_data_source* source = (bgm_data_source*)pDataSource;
+  BgmDecoder* d = source->decoder;
+  *pFormat = d->config.format;
+  *pChannels = d->get_channels();
+  *pSampleRate = d->get_sample_rate();
+  // swresample 和转换内核都按 ffmpeg 的默认布局输出，和 miniaudio 的标准布局一致
+  ma_channel_map_init_standard(ma_standard_channel_map_default, pChannelMap,
+                               channelMapCap, d->get_channels());
+  return MA_SUCCESS;
+}
+
+ma_result inline bgm_data_source_get_cursor(ma_data_source* pDataSource,
+                                            ma_uint64* pCursor) {
+  *pCursor = ((bgm_data_source*)pDataSource)->cursor;
+  return MA_SUCCESS;
+}
+
+/**
+ * ma_data_source_set_looping 的回调。miniaudio 在数据源返回 MA_AT_END 时从
+ * 播放线程调用 seek 回到开头，streaming 模式下 seek 要停止并重启解码线程，
+ * 不能在播放线程进行。所以只有以下两种情况可以打开循环：
+ * bgm_config.looping 的音轨由 BgmDecoder 自己循环，不会返回 MA_AT_END；
+ * 样本都在内存中时 seek 只移动读取位置。其他情况返回 MA_NOT_IMPLEMENTED。
+ * 关闭循环总是成功，但 bgm_config.looping 的音轨依然按自己的循环段循环
+ */
+ma_result inline bgm_data_source_set_looping(ma_data_source* pDataSource,
+                                             ma_bool32 isLooping) {
+  bgm_data_source* source = (bgm_data_source*)pDataSource;
+  BgmDecoder* d = source->decoder;
+  if (!isLooping || d->is_looping() || d->in_memory()) return MA_SUCCESS;
+
+  // ma_data_source_set_looping 在回调之前已经记录了循环状态
+  source->base.isLooping = MA_FALSE;
+  return MA_NOT_IMPLEMENTED;
+}
+
+/**
+ * 音轨的总帧数，解码完成之前可能是按时长估算的，时长未知时返回
+ * MA_NOT_IMPLEMENTED
+ */
+ma_result inline bgm_data_source_get_length(ma_data_source* pDataSource,
+                                            ma_uint64* pLength) {
+  *pLength = ((bgm_data_source*)pDataSource)->decoder->get_length();
+  return *pLength ? MA_SUCCESS : MA_NOT_IMPLEMENTED;
+}
+
+// inline 变量在所有翻译单元中是同一个对象，混音器按地址识别 bgm_data_source
+inline ma_data_source_vtable bgm_data_source_vtable = {
+    bgm_data_source_read,
+    bgm_data_source_seek,
+    bgm_data_source_get_data_format,
+    bgm_data_source_get_cursor,
+    bgm_data_source_get_length,
+    bgm_data_source_set_looping,
+    0,
+};
+
+/**
+ * 用已经 init 的 decoder 初始化数据源
+ *
+ * return
+ * MA_SUCCESS ok
+ */
+ma_result inline bgm_data_source_init(bgm_data_source* source,
+                                      BgmDecoder* decoder) {
+  ma_data_source_config config = ma_data_source_config_init();
+  config.vtable = &bgm_data_source_vtable;
+
+  ma_result result = ma_data_source_init(&config, &source->base);
+  if (result != MA_SUCCESS) return result;
+
+  source->decoder = decoder;
+  source->cursor = 0;
+  source->silenceFrames = 0;
+  source->underruns = 0;
+  return MA_SUCCESS;
+}
+
+/**
+ * 释放数据源，不会释放 decoder
+ */
+void inline bgm_data_source_uninit(bgm_data_source* source) {
+  ma_data_source_uninit(&source->base);
+}
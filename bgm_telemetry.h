@@ -0,0 +1,130 @@
+#pragma once
+
+/*
+播放回调的计时统计。
+
+每次回调记录两次单调时钟：回调耗时、和上一次回调开始的间隔（抖动）、
+请求和实际读到的帧数，以及回调耗时占这次回调周期（frameCount / sampleRate）
+比例的直方图。只有播放线程写入，所有计数都是 relaxed 的原子变量，
+写入只是 load + store，没有锁和 RMW；其他线程随时可以读取，
+读到的各项之间可能相差一次回调
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "miniaudio.h"
+
+/*
+直方图的格数：前 10 格每格是周期的 10%，最后一格是超过周期（错过截止时间）
+*/
+#define BGM_LOAD_BUCKETS 11
+
+typedef struct {
+  ma_uint64 callbacks;       /*回调次数*/
+  ma_uint64 framesRequested; /*设备请求的帧数*/
+  ma_uint64 framesDelivered; /*实际读到的帧数，其余是静音*/
+  ma_uint64 shortCallbacks;  /*读到的帧数少于请求的回调次数*/
+  ma_uint64 deadlineMisses;  /*耗时超过周期的回调次数*/
+  int64_t durationSum;       /*回调耗时的总和，单位纳秒*/
+  int64_t durationMax;       /*回调耗时的最大值*/
+  int64_t jitterSum;         /*|两次回调开始的间隔 - 上一次的周期| 的总和*/
+  int64_t jitterMax;
+  double loadMax;            /*耗时 / 周期 的最大值*/
+  ma_uint64 histogram[BGM_LOAD_BUCKETS]; /*耗时 / 周期 的分布*/
+} bgm_callback_stats;
+
+class BgmCallbackTelemetry {
+ private:
+  std::atomic<ma_uint64> callbacks{0};
+  std::atomic<ma_uint64> framesRequested{0};
+  std::atomic<ma_uint64> framesDelivered{0};
+  std::atomic<ma_uint64> shortCallbacks{0};
+  std::atomic<ma_uint64> deadlineMisses{0};
+  std::atomic<int64_t> durationSum{0};
+  std::atomic<int64_t> durationMax{0};
+  std::atomic<int64_t> jitterSum{0};
+  std::atomic<int64_t> jitterMax{0};
+  std::atomic<double> loadMax{0};
+  std::atomic<ma_uint64> histogram[BGM_LOAD_BUCKETS]{};
+
+  // 只由播放线程访问
+  int64_t lastBegin = 0;
+  int64_t lastPeriod = 0;
+
+ private:
+  // 只有一个写入者，不需要 fetch_add
+  template <typename T, typename V>
+  static void _add(std::atomic<T>& counter, V value) {
+    counter.store(counter.load(std::memory_order_relaxed) + (T)value,
+                  std::memory_order_relaxed);
+  }
+
+  template <typename T>
+  static void _max(std::atomic<T>& counter, T value) {
+    if (value > counter.load(std::memory_order_relaxed))
+      counter.store(value, std::memory_order_relaxed);
+  }
+
+ public:
+  /**
+   * 记录一次回调，由播放线程在回调结束时调用
+   *
+   * params
+   * begin end 回调开始和结束时的 bgm_now_ns
+   * frameCount 设备请求的帧数
+   * framesRead 实际读到的帧数
+   * sampleRate 设备的采样率
+   */
+  void record(int64_t begin, int64_t end, ma_uint32 frameCount,
+              ma_uint32 framesRead, ma_uint32 sampleRate) {
+    int64_t duration = end - begin;
+    int64_t period = (int64_t)frameCount * 1000000000 / sampleRate;
+
+    _add(callbacks, 1);
+    _add(framesRequested, frameCount);
+    _add(framesDelivered, framesRead);
+    if (framesRead < frameCount) _add(shortCallbacks, 1);
+
+    _add(durationSum, duration);
+    _max(durationMax, duration);
+
+    // 第一次回调之前可能等待了很久，不算抖动
+    if (lastBegin != 0) {
+      int64_t jitter = begin - lastBegin - lastPeriod;
+      if (jitter < 0) jitter = -jitter;
+      _add(jitterSum, jitter);
+      _max(jitterMax, jitter);
+    }
+    lastBegin = begin;
+    lastPeriod = period;
+
+    if (period <= 0) return;
+    double load = (double)duration / period;
+    _max(loadMax, load);
+    if (duration > period) _add(deadlineMisses, 1);
+    int bucket = std::min((int)(load * 10), BGM_LOAD_BUCKETS - 1);
+    _add(histogram[bucket], 1);
+  }
+
+  /**
+   * 获取统计，可以在其他线程调用
+   */
+  bgm_callback_stats get_stats() const {
+    bgm_callback_stats stats;
+    stats.callbacks = callbacks.load(std::memory_order_relaxed);
+    stats.framesRequested = framesRequested.load(std::memory_order_relaxed);
+    stats.framesDelivered = framesDelivered.load(std::memory_order_relaxed);
+    stats.shortCallbacks = shortCallbacks.load(std::memory_order_relaxed);
+    stats.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+    stats.durationSum = durationSum.load(std::memory_order_relaxed);
+    stats.durationMax = durationMax.load(std::memory_order_relaxed);
+    stats.jitterSum = jitterSum.load(std::memory_order_relaxed);
+    stats.jitterMax = jitterMax.load(std::memory_order_relaxed);
+    stats.loadMax = loadMax.load(std::memory_order_relaxed);
+    for (int i = 0; i < BGM_LOAD_BUCKETS; i++)
+      stats.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+    return stats;
+  }
+};
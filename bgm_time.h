@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+各模块共用的计时函数
+*/
+
+#include <chrono>
+#include <cstdint>
+
+/**
+ * 单调时钟，单位纳秒
+ */
+int64_t inline bgm_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}